@@ -0,0 +1,196 @@
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <omp.h>
+
+#include "Convergence.h"
+#include "SceneBench.h"
+#include "Pfm.h"
+
+using namespace rayt;
+
+namespace {
+	struct CurvePoint {
+		double seconds;
+		int samples;
+		double rmse;
+		double relMse;
+	};
+
+	double now()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// References draw sample indices from here on, far past any measured render,
+	// so their noise is independent of the images compared with them.
+	const int REFERENCE_FIRST_SAMPLE = 1 << 24;
+
+	// Adds one sample per pixel to a running sum per pass. Every thread keeps its
+	// own built scene, and pass k draws sample index firstSample + k, so the passes
+	// are disjoint parts of the sampler's sequence.
+	class ProgressiveRender {
+	public:
+		ProgressiveRender(const BenchScene& bench, const ConvergenceOptions& options, int firstSample)
+			: m_width(options.width)
+			, m_height(options.height)
+			, m_firstSample(firstSample)
+			, m_passes(0)
+			, m_sum(size_t(options.width) * options.height, Vector3(0))
+			, m_pass(m_sum.size()) {
+			for (int t = 0; t < omp_get_max_threads(); ++t) {
+				m_scenes.push_back(std::make_unique<Scene>(m_width, m_height, 1));
+				m_scenes.back()->setSceneType(bench.type);
+				m_scenes.back()->setIntegrator(options.integrator);
+				m_scenes.back()->build(BENCH_RGB.getX(), BENCH_RGB.getY(), BENCH_RGB.getZ(), BENCH_IOR);
+			}
+		}
+
+		void pass() {
+			for (auto& scene : m_scenes) {
+				scene->setFirstSample(m_firstSample + m_passes);
+			}
+#pragma omp parallel for schedule(dynamic)
+			for (int y = 0; y < m_height; ++y) {
+				Vector3* row = m_pass.data() + size_t(y) * m_width;
+				m_scenes[omp_get_thread_num()]->renderTile(0, y, m_width, y + 1, row);
+				for (int x = 0; x < m_width; ++x) {
+					m_sum[size_t(y) * m_width + x] += row[x];
+				}
+			}
+			++m_passes;
+		}
+
+		int passes() const { return m_passes; }
+
+		void image(std::vector<Vector3>& out) const {
+			out.resize(m_sum.size());
+			for (size_t i = 0; i < m_sum.size(); ++i) {
+				out[i] = m_sum[i] / float(m_passes);
+			}
+		}
+
+	private:
+		int m_width;
+		int m_height;
+		int m_firstSample;
+		int m_passes;
+		std::vector<Vector3> m_sum;
+		std::vector<Vector3> m_pass;
+		std::vector<std::unique_ptr<Scene>> m_scenes;
+	};
+
+	// relMSE divides by the squared reference plus this, so black pixels do not dominate.
+	const double REL_MSE_EPSILON = 1e-2;
+
+	void imageError(const std::vector<Vector3>& image, const std::vector<Vector3>& reference, double& rmse, double& relMse)
+	{
+		double se = 0;
+		double rel = 0;
+		for (size_t i = 0; i < image.size(); ++i) {
+			for (int c = 0; c < 3; ++c) {
+				double d = double(image[i][c]) - double(reference[i][c]);
+				se += d * d;
+				rel += d * d / (double(reference[i][c]) * double(reference[i][c]) + REL_MSE_EPSILON);
+			}
+		}
+		rmse = sqrt(se / double(image.size() * 3));
+		relMse = rel / double(image.size() * 3);
+	}
+
+	std::string referencePath(const ConvergenceOptions& options, const BenchScene& bench)
+	{
+		return options.referenceDir + "/reference_" + bench.name + ".pfm";
+	}
+
+	bool makeReference(const ConvergenceOptions& options, const BenchScene& bench)
+	{
+		ProgressiveRender render(bench, options, REFERENCE_FIRST_SAMPLE);
+		double begin = now();
+		while (render.passes() < options.referenceSamples) {
+			render.pass();
+		}
+		std::vector<Vector3> image;
+		render.image(image);
+		std::string path = referencePath(options, bench);
+		bool ok = write_pfm(path, options.width, options.height, image.data());
+		printf("%s: %d spp in %.1f s -> %s%s\n", bench.name, render.passes(), now() - begin, path.c_str(), ok ? "" : " (failed)");
+		return ok;
+	}
+
+	bool measure(const ConvergenceOptions& options, const BenchScene& bench, std::vector<CurvePoint>& curve)
+	{
+		int width, height;
+		std::vector<Vector3> reference;
+		std::string path = referencePath(options, bench);
+		if (!read_pfm(path, width, height, reference) || width != options.width || height != options.height) {
+			fprintf(stderr, "missing or mismatched reference %s\n", path.c_str());
+			return false;
+		}
+
+		std::vector<double> budgets = options.budgets;
+		std::sort(budgets.begin(), budgets.end());
+		std::vector<Vector3> image;
+		// Only rendering is timed; building the per-thread scenes is included, computing the error is not.
+		double rendered = 0;
+		double begin = now();
+		ProgressiveRender render(bench, options, 0);
+		size_t next = 0;
+		while (next < budgets.size()) {
+			render.pass();
+			rendered += now() - begin;
+			for (; next < budgets.size() && rendered >= budgets[next]; ++next) {
+				CurvePoint p = { rendered, render.passes(), 0, 0 };
+				render.image(image);
+				imageError(image, reference, p.rmse, p.relMse);
+				curve.push_back(p);
+				printf("%-16s %8.3f s %6d spp  RMSE %.6f  relMSE %.6f\n", bench.name, p.seconds, p.samples, p.rmse, p.relMse);
+			}
+			begin = now();
+		}
+		return true;
+	}
+}
+
+bool rayt::runConvergence(const ConvergenceOptions& options)
+{
+	bool ok = true;
+	if (options.makeReference) {
+		for (const BenchScene& bench : benchScenes()) {
+			ok = makeReference(options, bench) && ok;
+		}
+		return ok;
+	}
+
+	FILE* fp = nullptr;
+#ifdef _MSC_VER
+	if (fopen_s(&fp, options.output.c_str(), "w") != 0) fp = nullptr;
+#else
+	fp = fopen(options.output.c_str(), "w");
+#endif
+	if (!fp) {
+		fprintf(stderr, "failed to open %s\n", options.output.c_str());
+		return false;
+	}
+	fprintf(fp, "{\"integrator\": \"%s\", \"width\": %d, \"height\": %d, \"threads\": %d, \"scenes\": [",
+		options.integrator == kBDPT ? "bdpt" : "path", options.width, options.height, omp_get_max_threads());
+	bool first = true;
+	for (const BenchScene& bench : benchScenes()) {
+		std::vector<CurvePoint> curve;
+		if (!measure(options, bench, curve)) {
+			ok = false;
+			continue;
+		}
+		fprintf(fp, "%s\n{\"name\": \"%s\", \"curve\": [", first ? "" : ",", bench.name);
+		first = false;
+		for (size_t i = 0; i < curve.size(); ++i) {
+			fprintf(fp, "%s{\"seconds\": %.4f, \"spp\": %d, \"rmse\": %.6g, \"relmse\": %.6g}",
+				i ? ", " : "", curve[i].seconds, curve[i].samples, curve[i].rmse, curve[i].relMse);
+		}
+		fprintf(fp, "]}");
+	}
+	fprintf(fp, "\n]}\n");
+	return fclose(fp) == 0 && ok;
+}
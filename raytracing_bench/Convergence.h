@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Scene.h"
+
+namespace rayt {
+	// Error-versus-time curves: every canonical scene is rendered progressively,
+	// one sample per pixel per pass, and at each time budget the running image is
+	// compared with a high sample count reference (RMSE and relMSE). References
+	// are PFM files, reference_<scene>.pfm, made by the same code with
+	// makeReference set. They draw sample indices from 2^24 on, disjoint from the
+	// measured renders, so the error is not biased low by shared samples.
+	struct ConvergenceOptions {
+		std::string output = "bench_convergence.json";
+		std::string referenceDir = ".";
+		bool makeReference = false;
+		int referenceSamples = 4096;
+		std::vector<double> budgets = { 0.25, 0.5, 1, 2, 4, 8 }; // Seconds
+		IntegratorType integrator = kPathTracing;
+		int width = 128;
+		int height = 128;
+	};
+
+	// Returns false when a reference is missing or cannot be written.
+	bool runConvergence(const ConvergenceOptions& options);
+}
@@ -0,0 +1,188 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <omp.h>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+#include "SceneBench.h"
+#include "Scene.h"
+#include "Image.h"
+#include "RenderStats.h"
+
+using namespace rayt;
+
+namespace {
+	struct Result {
+		double seconds;      // Build + render + tone map
+		double buildSeconds;
+		double renderSeconds;
+		double tonemapSeconds;
+		uint64_t rays;
+		double peakRssMb;    // Of the process so far, so it includes earlier scenes
+		double mean;         // Image mean, to notice when a change alters the result
+	};
+
+	double now()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	double peakRssMb()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+			return double(counters.PeakWorkingSetSize) / (1024.0 * 1024.0);
+		}
+		return 0;
+#else
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return double(usage.ru_maxrss) / 1024.0; // KiB on Linux
+#endif
+	}
+
+	Result runScene(const BenchScene& sc, const SceneBenchOptions& options)
+	{
+		const Vector3& rgb = BENCH_RGB;
+		const float ior = BENCH_IOR;
+		const int pixelCount = options.width * options.height;
+		auto pixels = std::make_unique<Vector3[]>(pixelCount);
+		auto rgb8u = std::make_unique<Image::rgb[]>(pixelCount);
+
+		Result best = {};
+		for (int rep = 0; rep < options.repetitions; ++rep) {
+			for (int i = 0; i < pixelCount; ++i) {
+				pixels[i] = Vector3(0);
+			}
+			RenderStats::clearAll();
+			Result r = {};
+
+			double t0 = now();
+			Scene scene(options.width, options.height, options.samples);
+			scene.setSceneType(sc.type);
+			scene.build(rgb.getX(), rgb.getY(), rgb.getZ(), ior);
+			double t1 = now();
+#pragma omp parallel for schedule(dynamic)
+			for (int y = 0; y < options.height; ++y) {
+				scene.renderTile(0, y, options.width, y + 1, pixels.get() + size_t(y) * options.width);
+			}
+			double t2 = now();
+			ToneMapper().apply(pixels.get(), rgb8u.get(), pixelCount);
+			double t3 = now();
+
+			r.buildSeconds = t1 - t0;
+			r.renderSeconds = t2 - t1;
+			r.tonemapSeconds = t3 - t2;
+			r.seconds = t3 - t0;
+			r.rays = RenderStats::collect().rays();
+			for (int i = 0; i < pixelCount; ++i) {
+				r.mean += (pixels[i].getX() + pixels[i].getY() + pixels[i].getZ()) / 3.0;
+			}
+			r.mean /= pixelCount;
+			if (rep == 0 || r.seconds < best.seconds) {
+				best = r;
+			}
+		}
+		best.peakRssMb = peakRssMb();
+		return best;
+	}
+
+	std::string toJson(const BenchScene& sc, const Result& r, const SceneBenchOptions& options)
+	{
+		char buf[1024];
+		snprintf(buf, sizeof(buf),
+			"{\"name\": \"%s\", \"width\": %d, \"height\": %d, \"spp\": %d, \"threads\": %d, "
+			"\"seconds\": %.6f, \"mrays_per_s\": %.3f, \"rays\": %llu, \"peak_rss_mb_cumulative\": %.1f, "
+			"\"phases\": {\"build\": %.6f, \"render\": %.6f, \"tonemap\": %.6f}, \"mean\": %.6f}",
+			sc.name, options.width, options.height, options.samples, omp_get_max_threads(),
+			r.seconds, r.renderSeconds > 0 ? double(r.rays) / r.renderSeconds * 1e-6 : 0.0,
+			(unsigned long long)r.rays, r.peakRssMb,
+			r.buildSeconds, r.renderSeconds, r.tonemapSeconds, r.mean);
+		return buf;
+	}
+
+	// Reads "key": <number> from the object of the named scene in a file written by
+	// runSceneBenchmarks; returns a negative value when it is not there.
+	double baselineValue(const std::string& json, const char* scene, const char* key)
+	{
+		size_t begin = json.find(std::string("\"name\": \"") + scene + "\"");
+		if (begin == std::string::npos) {
+			return -1;
+		}
+		size_t end = json.find('\n', begin);
+		size_t pos = json.find(std::string("\"") + key + "\": ", begin);
+		if (pos == std::string::npos || pos > end) {
+			return -1;
+		}
+		return atof(json.c_str() + pos + strlen(key) + 4);
+	}
+}
+
+const std::vector<BenchScene>& rayt::benchScenes()
+{
+	static const std::vector<BenchScene> scenes = {
+		{ "cornell_prism", kCornellPrism },
+		{ "cornell_spheres", kCornellSpheres },
+		{ "cornell_mesh", kCornellMesh },
+	};
+	return scenes;
+}
+
+int rayt::runSceneBenchmarks(const SceneBenchOptions& options)
+{
+	std::string baseline;
+	if (!options.baseline.empty()) {
+		std::ifstream in(options.baseline);
+		if (!in) {
+			std::cerr << "failed to read " << options.baseline << std::endl;
+			return -1;
+		}
+		std::stringstream ss;
+		ss << in.rdbuf();
+		baseline = ss.str();
+	}
+
+	std::ofstream out(options.output);
+	out << "{\"scenes\": [\n";
+	int regressions = 0;
+	bool first = true;
+	for (const BenchScene& sc : benchScenes()) {
+		Result r = runScene(sc, options);
+		std::string json = toJson(sc, r, options);
+		out << (first ? "" : ",\n") << json;
+		first = false;
+		std::cout << json << std::endl;
+
+		if (options.baseline.empty()) {
+			continue;
+		}
+		double base = baselineValue(baseline, sc.name, "seconds");
+		if (base <= 0) {
+			++regressions;
+			printf("MISSING %s: not in baseline %s\n", sc.name, options.baseline.c_str());
+		}
+		else {
+			double change = r.seconds / base - 1.0;
+			bool regressed = change > options.threshold;
+			regressions += regressed ? 1 : 0;
+			printf("%s %s: %.4f s vs baseline %.4f s (%+.1f%%)\n",
+				regressed ? "REGRESSION" : "ok", sc.name, r.seconds, base, change * 100.0);
+		}
+	}
+	out << "\n]}\n";
+	return regressions;
+}
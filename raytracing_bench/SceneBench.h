@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Scene.h"
+
+namespace rayt {
+	struct BenchScene {
+		const char* name;
+		SceneType type;
+	};
+
+	// The canonical scenes, rendered with a white light and a 2.01 prism IOR.
+	const std::vector<BenchScene>& benchScenes();
+	const Vector3 BENCH_RGB(1, 1, 1);
+	constexpr float BENCH_IOR = 2.01f;
+
+	// End-to-end benchmarks: every canonical scene is rendered at a fixed
+	// resolution and sample count, and time, Mrays/s, peak RSS and phase timings
+	// are written as JSON. Peak RSS is that of the whole process up to the end of
+	// the scene, not of the scene alone. Scenes slower than a baseline file by more than
+	// threshold (a fraction) are flagged.
+	struct SceneBenchOptions {
+		std::string output = "bench_scenes.json";
+		std::string baseline; // Empty to skip the comparison
+		float threshold = 0.05f;
+		int width = 128;
+		int height = 128;
+		int samples = 16;
+		int repetitions = 3; // The fastest is reported
+	};
+
+	// Returns the number of regressions, counting scenes missing from the
+	// baseline, or -1 when the baseline cannot be read.
+	int runSceneBenchmarks(const SceneBenchOptions& options);
+}
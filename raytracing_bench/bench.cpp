@@ -0,0 +1,261 @@
+//
+// Microbenchmarks of the renderer's inner kernels. Every kernel runs over the
+// same pre-generated inputs (fixed seed), so numbers are comparable between runs
+// and builds.
+//
+// raytracing_bench scenes [--baseline file] [--output file] [--threshold fraction]
+//   [--size pixels] [--spp samples] runs the end-to-end scene benchmarks instead.
+//
+// raytracing_bench convergence [--make-reference] [--reference-dir dir]
+//   [--reference-spp samples] [--budgets s,s,...] [--integrator path|bdpt]
+//   [--size pixels] [--output file] reports error-versus-time curves.
+//
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cfloat>
+#include <algorithm>
+
+#include "Scene.h"
+#include "Camera.h"
+#include "Shape.h"
+#include "SceneBench.h"
+#include "Convergence.h"
+
+using namespace rayt;
+
+constexpr int INPUT_COUNT = 1 << 16;
+constexpr uint32_t SEED = 20191015;
+// Each kernel loops over its inputs for at least MIN_SECONDS, REPETITIONS times,
+// and the fastest repetition is reported.
+constexpr double MIN_SECONDS = 0.2;
+constexpr int REPETITIONS = 5;
+
+// Results are folded in here so the compiler cannot drop the work.
+volatile float g_sink;
+
+struct Interaction {
+	Ray ray;
+	HitRec hrec;
+};
+
+std::mt19937 rng(SEED);
+
+float uniform(float a, float b)
+{
+	return std::uniform_real_distribution<float>(a, b)(rng);
+}
+
+vec3 uniformIn(const vec3& lo, const vec3& hi)
+{
+	return vec3(uniform(lo.getX(), hi.getX()), uniform(lo.getY(), hi.getY()), uniform(lo.getZ(), hi.getZ()));
+}
+
+// Rays from anywhere in the Cornell box towards a random point of [lo, hi], so
+// most of them reach the shape under test.
+vector<Ray> aimedRays(const vec3& lo, const vec3& hi)
+{
+	vector<Ray> rays;
+	for (int i = 0; i < INPUT_COUNT; ++i) {
+		vec3 origin = uniformIn(vec3(1), vec3(554));
+		rays.push_back(Ray(origin, uniformIn(lo, hi) - origin));
+	}
+	return rays;
+}
+
+// Rays from anywhere in the Cornell box in uniformly random directions.
+vector<Ray> scatteredRays()
+{
+	vector<Ray> rays;
+	for (int i = 0; i < INPUT_COUNT; ++i) {
+		float z = uniform(-1.f, 1.f);
+		float r = sqrtf(std::max(0.f, 1.f - z * z));
+		float phi = uniform(0.f, PI2);
+		rays.push_back(Ray(uniformIn(vec3(1), vec3(554)), vec3(r * cosf(phi), r * sinf(phi), z)));
+	}
+	return rays;
+}
+
+// Hits of rays on shape whose material passes accept.
+template <typename Accept>
+vector<Interaction> interactions(const Shape& shape, const vector<Ray>& rays, Accept accept)
+{
+	vector<Interaction> result;
+	for (const Ray& r : rays) {
+		HitRec hrec;
+		if (shape.hit(r, 0.001f, FLT_MAX, hrec) && accept(*hrec.mat)) {
+			result.push_back({ r, hrec });
+		}
+	}
+	return result;
+}
+
+template <typename Op>
+void bench(const string& name, int count, Op op)
+{
+	double best = 1e30;
+	for (int rep = 0; rep < REPETITIONS; ++rep) {
+		long long ops = 0;
+		double seconds = 0;
+		auto begin = std::chrono::high_resolution_clock::now();
+		do {
+			float sum = 0;
+			for (int i = 0; i < count; ++i) {
+				sum += op(i);
+			}
+			g_sink = sum;
+			ops += count;
+			seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - begin).count();
+		} while (seconds < MIN_SECONDS);
+		best = std::min(best, seconds * 1e9 / double(ops));
+	}
+	std::cout << std::left << std::setw(36) << name << std::right << std::fixed
+		<< std::setw(10) << std::setprecision(2) << best
+		<< std::setw(12) << std::setprecision(2) << 1e3 / best << std::endl;
+}
+
+void benchHit(const string& name, const vector<Ray>& rays, const Shape& shape)
+{
+	bench(name, int(rays.size()), [&](int i) {
+		HitRec hrec;
+		return shape.hit(rays[i], 0.001f, FLT_MAX, hrec) ? hrec.t : 0.f;
+	});
+}
+
+void benchScatter(const string& name, const vector<Interaction>& hits, Sampler& sampler)
+{
+	bench(name, int(hits.size()), [&](int i) {
+		ScatterRec srec;
+		sampler.start(i, 0, 0);
+		return hits[i].hrec.mat->scatter(hits[i].ray, hits[i].hrec, srec, sampler) ? srec.ray.direction().getX() : 0.f;
+	});
+}
+
+int runScenes(int argc, char* argv[])
+{
+	SceneBenchOptions options;
+	for (int i = 2; i < argc; i += 2) {
+		string key = argv[i];
+		if (i + 1 >= argc) {
+			std::cerr << "missing value for " << key << std::endl;
+			return 2;
+		}
+		const char* value = argv[i + 1];
+		if (key == "--baseline") options.baseline = value;
+		else if (key == "--output") options.output = value;
+		else if (key == "--threshold") options.threshold = float(atof(value));
+		else if (key == "--size") options.width = options.height = atoi(value);
+		else if (key == "--spp") options.samples = atoi(value);
+		else {
+			std::cerr << "unknown option " << key << std::endl;
+			return 2;
+		}
+	}
+	int regressions = runSceneBenchmarks(options);
+	if (regressions < 0) {
+		return 2;
+	}
+	if (regressions > 0) {
+		std::cerr << regressions << " scene(s) regressed by more than " << options.threshold * 100.f << "%, or are missing from the baseline" << std::endl;
+	}
+	return regressions > 0 ? 1 : 0;
+}
+
+int runConvergence(int argc, char* argv[])
+{
+	ConvergenceOptions options;
+	for (int i = 2; i < argc; ++i) {
+		string key = argv[i];
+		if (key == "--make-reference") {
+			options.makeReference = true;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			std::cerr << "missing value for " << key << std::endl;
+			return 2;
+		}
+		const char* value = argv[++i];
+		if (key == "--reference-dir") options.referenceDir = value;
+		else if (key == "--reference-spp") options.referenceSamples = atoi(value);
+		else if (key == "--size") options.width = options.height = atoi(value);
+		else if (key == "--output") options.output = value;
+		else if (key == "--integrator") options.integrator = string(value) == "bdpt" ? kBDPT : kPathTracing;
+		else if (key == "--budgets") {
+			options.budgets.clear();
+			for (const char* p = value; *p; ) {
+				options.budgets.push_back(atof(p));
+				while (*p && *p != ',') ++p;
+				if (*p == ',') ++p;
+			}
+		}
+		else {
+			std::cerr << "unknown option " << key << std::endl;
+			return 2;
+		}
+	}
+	return rayt::runConvergence(options) ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && string(argv[1]) == "scenes") {
+		return runScenes(argc, argv);
+	}
+	if (argc > 1 && string(argv[1]) == "convergence") {
+		return runConvergence(argc, argv);
+	}
+
+	Scene scene(408, 408, 1, kSobolSampler);
+	scene.build(1.f, 1.f, 1.f, 2.01f);
+	MaterialPtr white = make_shared<Lambertian>(make_shared<ColorTexture>(vec3(0.73f)));
+
+	std::cout << std::left << std::setw(36) << "kernel" << std::right
+		<< std::setw(10) << "ns/op" << std::setw(12) << "Mops/s" << std::endl;
+
+	// Intersection: one op is one ray, so Mops/s is Mrays/s.
+	Sphere sphere(vec3(278, 278, 278), 100, white);
+	benchHit("Sphere::hit", aimedRays(vec3(178), vec3(378)), sphere);
+
+	auto wall = make_shared<Rect>(0, 555, 0, 555, 555, Rect::kXY, white);
+	const vector<Ray> wallRays = aimedRays(vec3(0, 0, 555), vec3(555, 555, 555));
+	benchHit("Rect::hit", wallRays, *wall);
+	benchHit("FlipNormals(Rect)::hit", wallRays, FlipNormals(wall));
+
+	Triangle triangle(70, 0, 280, 130, Triangle::kXY, white);
+	benchHit("Triangle::hit", aimedRays(vec3(70, 0, 130), vec3(350, 243, 130)), triangle);
+
+	// The slanted prism face
+	Rotate rotated(make_shared<Rect>(0, 280, 130, 180, 70, Rect::kYZ, white), vec3(0, 0, 1), -30);
+	benchHit("Rotate(Rect)::hit", aimedRays(vec3(70, 0, 130), vec3(210, 243, 180)), rotated);
+
+	const vector<Ray> rays = scatteredRays();
+	benchHit("ShapeList::hit (Cornell box)", rays, *scene.world());
+
+	// Shading
+	SobolSampler sampler;
+	benchScatter("Lambertian::scatter", interactions(*scene.world(), rays,
+		[](const Material& m) { return dynamic_cast<const Lambertian*>(&m) != nullptr; }), sampler);
+	benchScatter("Dielectric::scatter", interactions(*scene.world(), aimedRays(vec3(70, 0, 130), vec3(350, 243, 180)),
+		[](const Material& m) { return dynamic_cast<const Dielectric*>(&m) != nullptr; }), sampler);
+
+	bench("random_in_uint_sphere", INPUT_COUNT, [](int) {
+		return random_in_uint_sphere().getX();
+	});
+	vector<vec3> u3;
+	for (int i = 0; i < INPUT_COUNT; ++i) {
+		u3.push_back(uniformIn(vec3(0), vec3(1)));
+	}
+	bench("sample_in_unit_sphere", INPUT_COUNT, [&](int i) {
+		return sample_in_unit_sphere(u3[i].getX(), u3[i].getY(), u3[i].getZ()).getX();
+	});
+
+	// Camera
+	bench("Camera::getRay", INPUT_COUNT, [&](int i) {
+		return scene.camera().getRay(u3[i].getX(), u3[i].getY()).direction().getX();
+	});
+
+	return 0;
+}
@@ -0,0 +1,360 @@
+#include <cfloat>
+#include <algorithm>
+#include "BDPT.h"
+#include "Scene.h"
+#include "Shape.h"
+
+using namespace rayt;
+
+struct BDPT::Vertex {
+	enum Type {
+		kCamera = 0,
+		kLight,   // Point sampled on a light, start of a light subpath
+		kSurface
+	};
+	Type type;
+	HitRec hrec;
+	vec3 beta;
+	bool delta;
+	float pdfFwd;
+	float pdfRev;
+};
+
+namespace {
+	inline float remap0(float f) { return f != 0.f ? f : 1.f; }
+
+	// Sampler slots: the camera subpath's bounces, then the light subpath's, then
+	// the light samples of the s = 1 connections, so none of them shifts when
+	// another subpath changes length.
+	const int LIGHT_SUBPATH_SLOT = BDPT::MAX_DEPTH_LIMIT + 2;
+	const int CONNECTION_SLOT = 2 * (BDPT::MAX_DEPTH_LIMIT + 2);
+}
+
+BDPT::BDPT(const Scene& scene, int maxDepth)
+	: m_scene(scene)
+	, m_maxDepth(std::min(maxDepth, MAX_DEPTH_LIMIT)) {
+	for (auto& light : scene.lights()) {
+		HitRec hrec;
+		if (light->sample(0.5f, 0.5f, hrec)) {
+			m_lights.push_back(light.get());
+			m_lightMaterials.push_back(hrec.mat.get());
+		}
+	}
+}
+
+BDPT::~BDPT() = default;
+
+int BDPT::findLight(const Material* mat) const
+{
+	for (size_t i = 0; i < m_lightMaterials.size(); ++i) {
+		if (m_lightMaterials[i] == mat) {
+			return int(i);
+		}
+	}
+	return -1;
+}
+
+// Converts a solid angle density at `from` into an area density at `to`.
+static float convertDensity(float pdf, const vec3& from, const vec3& to, const vec3* n)
+{
+	vec3 d = to - from;
+	float dist2 = lengthSqr(d);
+	if (dist2 == 0.f) {
+		return 0.f;
+	}
+	if (n) {
+		pdf *= fabsf(dot(*n, d)) / sqrtf(dist2);
+	}
+	return pdf / dist2;
+}
+
+int BDPT::randomWalk(Ray r, vec3 beta, float pdfDir, Sampler& sampler, Vertex* path, int maxBounces, int firstSlot, bool& escaped) const
+{
+	escaped = false;
+	const Shape* world = m_scene.world();
+	int bounces = 0;
+	while (bounces < maxBounces) {
+		HitRec hrec;
+		RenderStats::countRay(bounces == 0 && path[0].type == Vertex::kCamera);
+		if (!world->hit(r, 0.001, FLT_MAX, hrec)) {
+			escaped = true;
+			break;
+		}
+		Vertex& prev = path[bounces];
+		Vertex& v = path[bounces + 1];
+		v.type = Vertex::kSurface;
+		v.hrec = hrec;
+		v.beta = beta;
+		v.delta = false;
+		v.pdfFwd = convertDensity(pdfDir, prev.hrec.p, hrec.p, &hrec.n);
+		v.pdfRev = 0;
+		++bounces;
+
+		ScatterRec srec;
+		sampler.startBounce(firstSlot + bounces - 1);
+		if (!hrec.mat->scatter(r, hrec, srec, sampler)) {
+			break;
+		}
+		float pdfRevDir = 0;
+		if (hrec.mat->isSpecular()) {
+			v.delta = true;
+			pdfDir = 0;
+		}
+		else {
+			vec3 wo = -normalize(r.direction());
+			vec3 wi = normalize(srec.ray.direction());
+			pdfDir = hrec.mat->pdf(hrec, wo, wi);
+			pdfRevDir = hrec.mat->pdf(hrec, wi, wo);
+		}
+		beta = mulPerElem(beta, srec.albedo);
+		prev.pdfRev = convertDensity(pdfRevDir, hrec.p, prev.hrec.p, prev.type == Vertex::kCamera ? nullptr : &prev.hrec.n);
+		r = srec.ray;
+	}
+	return bounces;
+}
+
+int BDPT::cameraSubpath(const Ray& r, Sampler& sampler, Vertex* path, bool& escaped) const
+{
+	Vertex& camera = path[0];
+	camera.type = Vertex::kCamera;
+	camera.hrec.p = r.origin();
+	camera.beta = vec3(1);
+	camera.delta = false;
+	camera.pdfFwd = 1;
+	camera.pdfRev = 0;
+	return randomWalk(Ray(r.origin(), normalize(r.direction())), vec3(1), 1.f, sampler, path, m_maxDepth + 1, 0, escaped) + 1;
+}
+
+bool BDPT::sampleLight(Sampler& sampler, Vertex& v) const
+{
+	if (!m_scene.sampleLight(sampler, v.hrec, v.pdfFwd)) {
+		return false;
+	}
+	v.type = Vertex::kLight;
+	v.delta = false;
+	v.pdfRev = 0;
+	// Emission is uniform over the front side, so Le is folded into beta here
+	// and only the side is checked when connecting.
+	v.beta = v.hrec.mat->emitted(Ray(v.hrec.p, v.hrec.n), v.hrec) / v.pdfFwd;
+	return true;
+}
+
+int BDPT::lightSubpath(Sampler& sampler, Vertex* path) const
+{
+	Vertex& light = path[0];
+	sampler.startBounce(LIGHT_SUBPATH_SLOT);
+	if (!sampleLight(sampler, light)) {
+		return 0;
+	}
+	float u1, u2;
+	sampler.get2D(u1, u2);
+	vec3 local = sample_cosine_hemisphere(u1, u2);
+	float pdfDir = local.getZ() * RECIP_PI;
+	if (pdfDir <= 0.f) {
+		return 1;
+	}
+	Ray r(light.hrec.p, ONB(light.hrec.n).local(local));
+	vec3 beta = light.beta * (local.getZ() / pdfDir);
+	bool escaped;
+	return randomWalk(r, beta, pdfDir, sampler, path, m_maxDepth, LIGHT_SUBPATH_SLOT + 1, escaped) + 1;
+}
+
+vec3 BDPT::f(const Vertex& v, const Vertex& a, const Vertex& b) const
+{
+	return v.hrec.mat->eval(v.hrec, normalize(a.hrec.p - v.hrec.p), normalize(b.hrec.p - v.hrec.p));
+}
+
+vec3 BDPT::Le(const Vertex& v, const Vertex& to) const
+{
+	vec3 w = to.hrec.p - v.hrec.p;
+	if (dot(v.hrec.n, w) <= 0.f) {
+		return vec3(0);
+	}
+	return v.hrec.mat->emitted(Ray(v.hrec.p, w), v.hrec);
+}
+
+float BDPT::pdf(const Vertex& v, const Vertex* prev, const Vertex& next) const
+{
+	const vec3* n = next.type == Vertex::kCamera ? nullptr : &next.hrec.n;
+	if (v.type == Vertex::kLight) {
+		return pdfLight(v, next);
+	}
+	if (v.type == Vertex::kCamera || !prev) {
+		return 0.f;
+	}
+	vec3 wo = normalize(prev->hrec.p - v.hrec.p);
+	vec3 wi = normalize(next.hrec.p - v.hrec.p);
+	return convertDensity(v.hrec.mat->pdf(v.hrec, wo, wi), v.hrec.p, next.hrec.p, n);
+}
+
+float BDPT::pdfLightOrigin(const Vertex& v) const
+{
+	int l = findLight(v.hrec.mat.get());
+	if (l < 0) {
+		return 0.f;
+	}
+	return 1.f / (m_lights.size() * m_lights[l]->area());
+}
+
+float BDPT::pdfLight(const Vertex& v, const Vertex& to) const
+{
+	vec3 w = normalize(to.hrec.p - v.hrec.p);
+	float pdfDir = std::max(dot(v.hrec.n, w), 0.f) * RECIP_PI;
+	return convertDensity(pdfDir, v.hrec.p, to.hrec.p, to.type == Vertex::kCamera ? nullptr : &to.hrec.n);
+}
+
+bool BDPT::visible(const Vertex& a, const Vertex& b) const
+{
+	vec3 d = b.hrec.p - a.hrec.p;
+	float dist = length(d);
+	HitRec hrec;
+	RenderStats::countRay(false);
+	return !m_scene.world()->hit(Ray(a.hrec.p, d / dist), 0.001f, dist - 0.001f, hrec);
+}
+
+float BDPT::misWeight(Vertex* lightPath, Vertex* cameraPath, Vertex& sampled, int s, int t) const
+{
+	if (s + t == 2) {
+		return 1.f;
+	}
+
+	// Temporarily turn the vertices into what this strategy would have produced.
+	Vertex savedLight0;
+	if (s == 1) {
+		savedLight0 = lightPath[0];
+		lightPath[0] = sampled;
+	}
+	Vertex* qs = s > 0 ? &lightPath[s - 1] : nullptr;
+	Vertex* pt = &cameraPath[t - 1];
+	Vertex* qsMinus = s > 1 ? &lightPath[s - 2] : nullptr;
+	Vertex* ptMinus = &cameraPath[t - 2];
+
+	const float savedPtRev = pt->pdfRev;
+	const float savedPtMinusRev = ptMinus->pdfRev;
+	const bool savedPtDelta = pt->delta;
+	const float savedQsRev = qs ? qs->pdfRev : 0.f;
+	const bool savedQsDelta = qs ? qs->delta : false;
+	const float savedQsMinusRev = qsMinus ? qsMinus->pdfRev : 0.f;
+
+	pt->delta = false;
+	if (qs) {
+		qs->delta = false;
+	}
+	pt->pdfRev = s > 0 ? pdf(*qs, qsMinus, *pt) : pdfLightOrigin(*pt);
+	ptMinus->pdfRev = s > 0 ? pdf(*pt, qs, *ptMinus) : pdfLight(*pt, *ptMinus);
+	if (qs) {
+		qs->pdfRev = pdf(*pt, ptMinus, *qs);
+	}
+	if (qsMinus) {
+		qsMinus->pdfRev = pdf(*qs, pt, *qsMinus);
+	}
+
+	// Power heuristic (beta = 2) via ratios of neighbouring strategy pdfs.
+	float sumRi = 0.f;
+	float ri = 1.f;
+	for (int i = t - 1; i > 1; --i) {
+		ri *= pow2(remap0(cameraPath[i].pdfRev) / remap0(cameraPath[i].pdfFwd));
+		if (!cameraPath[i].delta && !cameraPath[i - 1].delta) {
+			sumRi += ri;
+		}
+	}
+	ri = 1.f;
+	for (int i = s - 1; i >= 0; --i) {
+		ri *= pow2(remap0(lightPath[i].pdfRev) / remap0(lightPath[i].pdfFwd));
+		bool deltaPrev = i > 0 ? lightPath[i - 1].delta : false;
+		if (!lightPath[i].delta && !deltaPrev) {
+			sumRi += ri;
+		}
+	}
+
+	pt->pdfRev = savedPtRev;
+	ptMinus->pdfRev = savedPtMinusRev;
+	pt->delta = savedPtDelta;
+	if (qs) {
+		qs->pdfRev = savedQsRev;
+		qs->delta = savedQsDelta;
+	}
+	if (qsMinus) {
+		qsMinus->pdfRev = savedQsMinusRev;
+	}
+	if (s == 1) {
+		lightPath[0] = savedLight0;
+	}
+	return 1.f / (1.f + sumRi);
+}
+
+vec3 BDPT::connect(Vertex* lightPath, Vertex* cameraPath, int s, int t, Sampler& sampler) const
+{
+	const Vertex& pt = cameraPath[t - 1];
+	const Vertex& ptMinus = cameraPath[t - 2];
+	Vertex sampled;
+	vec3 L(0);
+
+	if (s == 0) {
+		if (findLight(pt.hrec.mat.get()) < 0) {
+			return vec3(0);
+		}
+		L = mulPerElem(pt.beta, Le(pt, ptMinus));
+	}
+	else if (s == 1) {
+		sampler.startBounce(CONNECTION_SLOT + t);
+		if (pt.delta || !sampleLight(sampler, sampled)) {
+			return vec3(0);
+		}
+		vec3 d = sampled.hrec.p - pt.hrec.p;
+		float dist2 = lengthSqr(d);
+		float cosLight = -dot(sampled.hrec.n, d);
+		if (cosLight <= 0.f) {
+			return vec3(0);
+		}
+		float G = fabsf(dot(pt.hrec.n, d)) * cosLight / pow2(dist2);
+		L = mulPerElem(mulPerElem(pt.beta, f(pt, ptMinus, sampled)), sampled.beta) * G;
+		if (lengthSqr(L) == 0.f || !visible(pt, sampled)) {
+			return vec3(0);
+		}
+	}
+	else {
+		const Vertex& qs = lightPath[s - 1];
+		const Vertex& qsMinus = lightPath[s - 2];
+		if (qs.delta || pt.delta) {
+			return vec3(0);
+		}
+		vec3 d = pt.hrec.p - qs.hrec.p;
+		float dist2 = lengthSqr(d);
+		float G = fabsf(dot(qs.hrec.n, d)) * fabsf(dot(pt.hrec.n, d)) / pow2(dist2);
+		L = mulPerElem(mulPerElem(qs.beta, f(qs, qsMinus, pt)), mulPerElem(f(pt, ptMinus, qs), pt.beta)) * G;
+		if (lengthSqr(L) == 0.f || !visible(qs, pt)) {
+			return vec3(0);
+		}
+	}
+
+	if (lengthSqr(L) == 0.f) {
+		return L;
+	}
+	return L * misWeight(lightPath, cameraPath, sampled, s, t);
+}
+
+vec3 BDPT::Li(const Ray& r, Sampler& sampler) const
+{
+	Vertex cameraPath[MAX_DEPTH_LIMIT + 2];
+	Vertex lightPath[MAX_DEPTH_LIMIT + 1];
+
+	bool escaped;
+	int nCamera = cameraSubpath(r, sampler, cameraPath, escaped);
+	int nLight = lightSubpath(sampler, lightPath);
+
+	vec3 L(0);
+	if (escaped) {
+		L += mulPerElem(cameraPath[nCamera - 1].beta, m_scene.backColor());
+	}
+	for (int t = 2; t <= nCamera; ++t) {
+		for (int s = 0; s <= nLight; ++s) {
+			int depth = s + t - 2;
+			if (depth > m_maxDepth) {
+				continue;
+			}
+			L += connect(lightPath, cameraPath, s, t, sampler);
+		}
+	}
+	return L;
+}
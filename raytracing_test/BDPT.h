@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include "inline_math.h"
+#include "Sampler.h"
+
+namespace rayt {
+	class Scene;
+	class Shape;
+	class Material;
+	class Ray;
+
+	// Bidirectional path tracing (Veach 1997) with power-heuristic MIS.
+	// A camera and a light subpath are generated per sample and every pair of
+	// their vertices is connected. Strategies that splat onto the image plane
+	// (t = 1) are not used, so the weights are computed over the remaining ones.
+	class BDPT {
+	public:
+		static constexpr int MAX_DEPTH_LIMIT = 32;
+
+		BDPT(const Scene& scene, int maxDepth = 16);
+		~BDPT();
+
+		vec3 Li(const Ray& r, Sampler& sampler) const;
+
+	private:
+		struct Vertex;
+
+		// Bounce i draws from sampler slot firstSlot + i (see Sampler::startBounce).
+		int randomWalk(Ray r, vec3 beta, float pdf, Sampler& sampler, Vertex* path, int maxBounces, int firstSlot, bool& escaped) const;
+		int cameraSubpath(const Ray& r, Sampler& sampler, Vertex* path, bool& escaped) const;
+		int lightSubpath(Sampler& sampler, Vertex* path) const;
+		bool sampleLight(Sampler& sampler, Vertex& v) const;
+
+		vec3 connect(Vertex* lightPath, Vertex* cameraPath, int s, int t, Sampler& sampler) const;
+		float misWeight(Vertex* lightPath, Vertex* cameraPath, Vertex& sampled, int s, int t) const;
+
+		vec3 f(const Vertex& v, const Vertex& a, const Vertex& b) const;
+		vec3 Le(const Vertex& v, const Vertex& to) const;
+		float pdf(const Vertex& v, const Vertex* prev, const Vertex& next) const;
+		float pdfLightOrigin(const Vertex& v) const;
+		float pdfLight(const Vertex& v, const Vertex& to) const;
+		bool visible(const Vertex& a, const Vertex& b) const;
+		int findLight(const Material* mat) const;
+
+		const Scene& m_scene;
+		int m_maxDepth;
+		std::vector<const Shape*> m_lights;
+		std::vector<const Material*> m_lightMaterials;
+	};
+}
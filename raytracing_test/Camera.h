@@ -29,6 +29,28 @@ namespace rayt {
 			return Ray(m_origin, m_uvw[2] + m_uvw[0] * u + m_uvw[1] * v - m_origin);
 		}
 
+		// Inverse of getRay: maps p to film coordinates (u, v) and returns the importance
+		// of the whole film in that direction times the cosine at the lens, 0 when p is off the film.
+		float project(const vec3& p, float& u, float& v) const {
+			vec3 d = p - m_origin;
+			vec3 forward = m_uvw[2] + (m_uvw[0] + m_uvw[1]) * 0.5f - m_origin; // Film is at distance 1
+			float z = dot(d, forward);
+			if (z <= 0.f) {
+				return 0.f;
+			}
+			vec3 q = m_origin + d / z - m_uvw[2];
+			u = dot(q, m_uvw[0]) / lengthSqr(m_uvw[0]);
+			v = dot(q, m_uvw[1]) / lengthSqr(m_uvw[1]);
+			if (u < 0.f || u >= 1.f || v < 0.f || v >= 1.f) {
+				return 0.f;
+			}
+			float cosTheta = z / length(d);
+			float area = length(m_uvw[0]) * length(m_uvw[1]);
+			return 1.f / (area * pow3(cosTheta));
+		}
+
+		const vec3& origin() const { return m_origin; }
+
 	private:
 		vec3 m_origin; // Position
 		vec3 m_uvw[3]; // Orthogonal Basis Vectors
@@ -0,0 +1,339 @@
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <new>
+#include <omp.h>
+#include "stb_image_write.h"
+#include "Daemon.h"
+#include "Net.h"
+#include "Image.h"
+#include "ExrWriter.h"
+#include "Pfm.h"
+#include "Trace.h"
+
+using namespace rayt;
+
+namespace {
+	const int POLL_MS = 500;
+	const size_t MAX_LINE = 1 << 16;
+	const int MAX_SIZE = 8192;
+	const int MAX_SAMPLES = 1 << 16;
+
+	double now()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	bool endsWith(const std::string& s, const std::string& suffix)
+	{
+		return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	bool parseVector(const std::string& value, vec3& v)
+	{
+		float x, y, z;
+		char c1, c2;
+		std::istringstream in(value);
+		if (!(in >> x >> c1 >> y >> c2 >> z) || c1 != ',' || c2 != ',') {
+			return false;
+		}
+		v = vec3(x, y, z);
+		return true;
+	}
+
+	struct Job {
+		SceneType scene = kCornellPrism;
+		IntegratorType integrator = kPathTracing;
+		int width = 128;
+		int height = 128;
+		int samples = 16;
+		std::vector<int> passes; // Empty for all of them
+		vec3 lookfrom = vec3(278, 278, -800);
+		vec3 lookat = vec3(278, 278, 0);
+		float vfov = 40;
+		std::string output;
+	};
+
+	// Parses the key=value arguments of a render line; returns an error message, empty when it is valid.
+	std::string parseJob(std::istringstream& args, int passCount, Job& job)
+	{
+		std::string arg;
+		while (args >> arg) {
+			size_t eq = arg.find('=');
+			if (eq == std::string::npos) {
+				return "expected key=value, got " + arg;
+			}
+			const std::string key = arg.substr(0, eq);
+			const std::string value = arg.substr(eq + 1);
+			if (key == "output") {
+				job.output = value;
+			}
+			else if (key == "scene") {
+				if (value == "prism") job.scene = kCornellPrism;
+				else if (value == "spheres") job.scene = kCornellSpheres;
+				else if (value == "mesh") job.scene = kCornellMesh;
+				else return "unknown scene " + value;
+			}
+			else if (key == "integrator") {
+				if (value == "path") job.integrator = kPathTracing;
+				else if (value == "bdpt") job.integrator = kBDPT;
+				else return "unknown integrator " + value;
+			}
+			else if (key == "width") job.width = atoi(value.c_str());
+			else if (key == "height") job.height = atoi(value.c_str());
+			else if (key == "spp") job.samples = atoi(value.c_str());
+			else if (key == "fov") job.vfov = float(atof(value.c_str()));
+			else if (key == "lookfrom" || key == "lookat") {
+				if (!parseVector(value, key == "lookfrom" ? job.lookfrom : job.lookat)) {
+					return "expected x,y,z for " + key;
+				}
+			}
+			else if (key == "passes") {
+				job.passes.clear();
+				std::istringstream list(value);
+				std::string p;
+				while (std::getline(list, p, ',')) {
+					int pass = atoi(p.c_str());
+					if (pass < 0 || pass >= passCount) {
+						return "pass " + p + " out of range";
+					}
+					job.passes.push_back(pass);
+				}
+				if (int(job.passes.size()) > passCount) {
+					return "more passes than the " + std::to_string(passCount) + " there are";
+				}
+			}
+			else {
+				return "unknown key " + key;
+			}
+		}
+		if (job.output.empty()) {
+			return "missing output";
+		}
+		if (!endsWith(job.output, ".exr") && !endsWith(job.output, ".bmp") && !endsWith(job.output, ".pfm")) {
+			return "output must be .exr, .bmp or .pfm";
+		}
+		if (job.width <= 0 || job.height <= 0 || job.samples <= 0 || job.vfov <= 0 || job.vfov >= 180) {
+			return "bad width, height, spp or fov";
+		}
+		if (job.width > MAX_SIZE || job.height > MAX_SIZE || job.samples > MAX_SAMPLES) {
+			return "width and height are limited to " + std::to_string(MAX_SIZE) + ", spp to " + std::to_string(MAX_SAMPLES);
+		}
+		if (job.passes.empty()) {
+			for (int p = 0; p < passCount; ++p) {
+				job.passes.push_back(p);
+			}
+		}
+		return "";
+	}
+
+	struct Client {
+		Socket socket;
+		std::string buffer; // Received, not yet a whole line
+	};
+
+	class Daemon {
+	public:
+		Daemon(const DaemonOptions& options)
+			: m_options(options)
+			, m_jobs(0)
+			, m_shutdown(false) { }
+
+		bool run() {
+			Socket listener;
+			if (!listener.listen(m_options.port, true)) {
+				std::cerr << "failed to listen on port " << m_options.port << std::endl;
+				return false;
+			}
+			std::cout << "serving on 127.0.0.1:" << m_options.port << " with " << m_options.threads << " threads" << std::endl;
+
+			while (!m_shutdown) {
+				std::vector<Socket*> sockets(1, &listener);
+				for (auto& c : m_clients) {
+					sockets.push_back(&c->socket);
+				}
+				std::vector<bool> readable;
+				if (!Socket::wait(sockets, POLL_MS, readable)) {
+					std::cerr << "select failed" << std::endl;
+					return false;
+				}
+				if (readable[0]) {
+					Socket s = listener.accept();
+					if (s.valid()) {
+						m_clients.push_back(std::make_unique<Client>(Client{ std::move(s), std::string() }));
+					}
+				}
+				for (size_t i = 1; i < readable.size() && !m_shutdown; ++i) {
+					if (readable[i] && !serve(*m_clients[i - 1])) {
+						m_clients[i - 1]->socket.close();
+					}
+				}
+				m_clients.erase(std::remove_if(m_clients.begin(), m_clients.end(),
+					[](const std::unique_ptr<Client>& c) { return !c->socket.valid(); }), m_clients.end());
+			}
+			std::cout << "shut down after " << m_jobs << " jobs" << std::endl;
+			return true;
+		}
+
+	private:
+		// Reads what has arrived and answers every complete line; false once the client is gone.
+		bool serve(Client& c) {
+			char data[4096];
+			int received = c.socket.recvSome(data, sizeof(data));
+			if (received <= 0) {
+				return false;
+			}
+			c.buffer.append(data, size_t(received));
+			size_t eol;
+			while ((eol = c.buffer.find('\n')) != std::string::npos && !m_shutdown) {
+				std::string line = c.buffer.substr(0, eol);
+				c.buffer.erase(0, eol + 1);
+				if (!line.empty() && line.back() == '\r') {
+					line.pop_back();
+				}
+				std::string reply = execute(line) + "\n";
+				if (!c.socket.sendAll(reply.data(), reply.size())) {
+					return false;
+				}
+			}
+			return c.buffer.size() <= MAX_LINE;
+		}
+
+		std::string execute(const std::string& line) {
+			std::istringstream args(line);
+			std::string command;
+			args >> command;
+			if (command == "render") {
+				Job job;
+				std::string error = parseJob(args, int(m_options.rgb.size()), job);
+				if (!error.empty()) {
+					return "error " + error;
+				}
+				// A job too large for this machine must not take the resident scenes down with it.
+				try {
+					return render(job);
+				}
+				catch (const std::bad_alloc&) {
+					return "error out of memory";
+				}
+			}
+			if (command == "status") {
+				return "ok " + std::to_string(m_resident.size()) + " resident scenes, " + std::to_string(m_jobs) + " jobs";
+			}
+			if (command == "shutdown") {
+				m_shutdown = true;
+				return "ok";
+			}
+			return "error unknown command " + command;
+		}
+
+		// The built scene of a scene type and wavelength pass, built on first use.
+		const Scene& resident(SceneType type, int pass) {
+			std::unique_ptr<Scene>& scene = m_resident[std::make_pair(int(type), pass)];
+			if (!scene) {
+				const Vector3& rgb = m_options.rgb[pass];
+				scene = std::make_unique<Scene>(1, 1, 1, m_options.sampler);
+				scene->setSceneType(type);
+				scene->build(rgb.getX(), rgb.getY(), rgb.getZ(), m_options.ior[pass]);
+			}
+			return *scene;
+		}
+
+		std::string render(const Job& job) {
+			TraceScope trace("job", m_jobs);
+			const double begin = now();
+			const size_t pixelCount = size_t(job.width) * job.height;
+
+			// Views share the resident geometry, which is only read while rendering.
+			std::vector<std::unique_ptr<Scene>> views;
+			for (int pass : job.passes) {
+				views.push_back(std::make_unique<Scene>(resident(job.scene, pass), job.width, job.height, job.samples, m_options.sampler));
+				views.back()->setIntegrator(job.integrator);
+				views.back()->setCamera(job.lookfrom, job.lookat, job.vfov);
+			}
+			std::vector<Vector3> pixels(pixelCount * (views.size() + 1), Vector3(0));
+			const int tasks = int(views.size()) * job.height;
+#pragma omp parallel for schedule(dynamic) num_threads(m_options.threads)
+			for (int t = 0; t < tasks; ++t) {
+				const int v = t / job.height;
+				const int y = t % job.height;
+				views[v]->renderTile(0, y, job.width, y + 1, pixels.data() + pixelCount * v + size_t(y) * job.width);
+			}
+			Vector3* sum = pixels.data() + pixelCount * views.size();
+			for (size_t v = 0; v < views.size(); ++v) {
+				for (size_t i = 0; i < pixelCount; ++i) {
+					sum[i] += pixels[pixelCount * v + i];
+				}
+			}
+
+			if (!save(job, pixels)) {
+				return "error failed to write " + job.output;
+			}
+			++m_jobs;
+			const double seconds = now() - begin;
+			std::cout << job.output << ": " << job.width << "x" << job.height << " " << job.samples << " spp, "
+				<< views.size() << " passes, " << seconds << "[s]" << std::endl;
+			return "ok " + std::to_string(seconds) + " " + job.output;
+		}
+
+		// pixels holds every pass of the job, then their sum.
+		bool save(const Job& job, const std::vector<Vector3>& pixels) {
+			const size_t pixelCount = size_t(job.width) * job.height;
+			const Vector3* sum = pixels.data() + pixelCount * job.passes.size();
+			if (endsWith(job.output, ".exr")) {
+				std::vector<std::string> names;
+				std::vector<const Vector3*> layers;
+				for (size_t v = 0; v < job.passes.size(); ++v) {
+					names.push_back("ray_" + std::to_string(job.passes[v]));
+					layers.push_back(pixels.data() + pixelCount * v);
+				}
+				names.push_back("sum");
+				layers.push_back(sum);
+				return write_exr(job.output, job.width, job.height, names, layers);
+			}
+			if (endsWith(job.output, ".pfm")) {
+				return write_pfm(job.output, job.width, job.height, sum);
+			}
+			std::vector<Image::rgb> rgb8u(pixelCount);
+			m_tonemap.apply(sum, rgb8u.data(), int(pixelCount));
+			return stbi_write_bmp(job.output.c_str(), job.width, job.height, sizeof(Image::rgb), rgb8u.data()) != 0;
+		}
+
+		const DaemonOptions& m_options;
+		std::map<std::pair<int, int>, std::unique_ptr<Scene>> m_resident;
+		std::vector<std::unique_ptr<Client>> m_clients;
+		ToneMapper m_tonemap;
+		int m_jobs;
+		bool m_shutdown;
+	};
+}
+
+bool rayt::runDaemon(const DaemonOptions& options)
+{
+	Daemon daemon(options);
+	return daemon.run();
+}
+
+bool rayt::submitToDaemon(int port, const std::string& line)
+{
+	Socket socket;
+	if (!socket.connect("127.0.0.1", port)) {
+		std::cerr << "no render server on port " << port << std::endl;
+		return false;
+	}
+	std::string request = line + "\n";
+	if (!socket.sendAll(request.data(), request.size())) {
+		return false;
+	}
+	std::string reply;
+	char c;
+	while (socket.recvAll(&c, 1) && c != '\n') {
+		reply += c;
+	}
+	std::cout << reply << std::endl;
+	return reply.compare(0, 2, "ok") == 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Scene.h"
+
+namespace rayt {
+	// Long-running render server. Built scenes stay resident, one per scene type
+	// and wavelength pass, and every job renders views of them, so a job costs no
+	// process start or scene build. Jobs are text lines on a loopback TCP socket:
+	//
+	//   render output=preview.exr scene=prism width=128 height=128 spp=16
+	//          passes=0,1,2 integrator=path lookfrom=278,278,-800 lookat=278,278,0 fov=40
+	//
+	// Only output is required; it may be .exr (every pass and their sum), .bmp or
+	// .pfm (the sum). Each line is answered with one line, "ok <seconds> <output>"
+	// or "error <reason>". "status" reports the resident scenes and jobs served,
+	// "shutdown" stops the server. Jobs run one at a time, each on every thread.
+	struct DaemonOptions {
+		int port;
+		int threads;
+		SamplerType sampler;
+		std::vector<Vector3> rgb; // Light color of every wavelength pass
+		std::vector<float> ior;   // Prism IOR of every wavelength pass
+	};
+
+	bool runDaemon(const DaemonOptions& options);
+
+	// Sends one line to the server on port and prints its answer.
+	bool submitToDaemon(int port, const std::string& line);
+}
@@ -0,0 +1,151 @@
+#include <cmath>
+#include <algorithm>
+#include "Denoiser.h"
+
+using namespace rayt;
+
+namespace {
+	const float KERNEL[3] = { 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+
+	// Albedo below this is treated as black and left undivided.
+	const float MIN_ALBEDO = 0.01f;
+
+	inline float demodulate(float c, float a) { return a > MIN_ALBEDO ? c / a : c; }
+	inline float remodulate(float c, float a) { return a > MIN_ALBEDO ? c * a : c; }
+
+	// Color distances are taken after compressing HDR values into [0, 1).
+	inline float compress(float c) { return c / (1.f + std::max(c, 0.f)); }
+}
+
+Denoiser::Denoiser(int width, int height, int iterations)
+	: m_width(width)
+	, m_height(height)
+	, m_iterations(iterations)
+	, m_sigmaColor(4.f)
+	, m_sigmaNormal(0.3f)
+	, m_sigmaDepth(0.02f)
+	, m_sigmaAlbedo(0.1f) { }
+
+void Denoiser::setSigmas(float color, float normal, float depth, float albedo)
+{
+	m_sigmaColor = color;
+	m_sigmaNormal = normal;
+	m_sigmaDepth = depth;
+	m_sigmaAlbedo = albedo;
+}
+
+void Denoiser::apply(const Vector3 color[], const Vector3 albedo[], const Vector3 normal[], const float depth[], Vector3 out[]) const
+{
+	const int pixelCount = m_width * m_height;
+	std::vector<float> src(size_t(pixelCount) * 3);
+	std::vector<float> dst(size_t(pixelCount) * 3);
+#pragma omp parallel for
+	for (int i = 0; i < pixelCount; ++i) {
+		src[i * 3 + 0] = demodulate(color[i].getX(), albedo[i].getX());
+		src[i * 3 + 1] = demodulate(color[i].getY(), albedo[i].getY());
+		src[i * 3 + 2] = demodulate(color[i].getZ(), albedo[i].getZ());
+	}
+
+	const int tilesX = (m_width + TILE_SIZE - 1) / TILE_SIZE;
+	const int tilesY = (m_height + TILE_SIZE - 1) / TILE_SIZE;
+	std::vector<float> variance(pixelCount);
+#pragma omp parallel for schedule(dynamic)
+	for (int t = 0; t < tilesX * tilesY; ++t) {
+		int x0 = (t % tilesX) * TILE_SIZE;
+		int y0 = (t / tilesX) * TILE_SIZE;
+		localVariance(x0, y0, std::min(x0 + TILE_SIZE, m_width), std::min(y0 + TILE_SIZE, m_height), src, variance);
+	}
+
+	for (int it = 0; it < m_iterations; ++it) {
+		// The color tolerance tightens as the stride grows and the input gets smoother.
+		const float sigmaColor = m_sigmaColor * powf(0.5f, float(it));
+#pragma omp parallel for schedule(dynamic)
+		for (int t = 0; t < tilesX * tilesY; ++t) {
+			int x0 = (t % tilesX) * TILE_SIZE;
+			int y0 = (t / tilesX) * TILE_SIZE;
+			pass(x0, y0, std::min(x0 + TILE_SIZE, m_width), std::min(y0 + TILE_SIZE, m_height),
+				1 << it, sigmaColor, src, dst, variance, albedo, normal, depth);
+		}
+		src.swap(dst);
+	}
+
+#pragma omp parallel for
+	for (int i = 0; i < pixelCount; ++i) {
+		out[i] = vec3(
+			remodulate(src[i * 3 + 0], albedo[i].getX()),
+			remodulate(src[i * 3 + 1], albedo[i].getY()),
+			remodulate(src[i * 3 + 2], albedo[i].getZ()));
+	}
+}
+
+void Denoiser::localVariance(int x0, int y0, int x1, int y1, const std::vector<float>& src, std::vector<float>& variance) const
+{
+	const int r = VARIANCE_RADIUS;
+	for (int y = y0; y < y1; ++y) {
+		for (int x = x0; x < x1; ++x) {
+			float sum = 0;
+			float sumSqr = 0;
+			int n = 0;
+			for (int qy = std::max(y - r, 0); qy <= std::min(y + r, m_height - 1); ++qy) {
+				for (int qx = std::max(x - r, 0); qx <= std::min(x + r, m_width - 1); ++qx) {
+					const int q = qy * m_width + qx;
+					float c = compress(src[q * 3 + 0]) + compress(src[q * 3 + 1]) + compress(src[q * 3 + 2]);
+					sum += c;
+					sumSqr += c * c;
+					++n;
+				}
+			}
+			variance[y * m_width + x] = std::max(sumSqr / n - pow2(sum / n), 0.f);
+		}
+	}
+}
+
+void Denoiser::pass(int x0, int y0, int x1, int y1, int stride, float sigmaColor,
+	const std::vector<float>& src, std::vector<float>& dst, const std::vector<float>& variance,
+	const Vector3 albedo[], const Vector3 normal[], const float depth[]) const
+{
+	const float recipNormal = 1.f / pow2(m_sigmaNormal);
+	const float recipAlbedo = 1.f / pow2(m_sigmaAlbedo);
+	for (int y = y0; y < y1; ++y) {
+		for (int x = x0; x < x1; ++x) {
+			const int p = y * m_width + x;
+			const float cp[3] = { compress(src[p * 3 + 0]), compress(src[p * 3 + 1]), compress(src[p * 3 + 2]) };
+			// Color tolerance follows the input noise level around p.
+			const float recipColor = 1.f / (pow2(sigmaColor) * variance[p] + 1e-4f);
+			// Depth tolerance scales with distance and stride, so slanted planes stay connected.
+			const float recipDepth = 1.f / pow2(m_sigmaDepth * stride * std::max(depth[p], 1.f));
+
+			float sum[3] = { 0, 0, 0 };
+			float weightSum = 0;
+			for (int dy = -2; dy <= 2; ++dy) {
+				const int qy = y + dy * stride;
+				if (qy < 0 || qy >= m_height) {
+					continue;
+				}
+				for (int dx = -2; dx <= 2; ++dx) {
+					const int qx = x + dx * stride;
+					if (qx < 0 || qx >= m_width) {
+						continue;
+					}
+					const int q = qy * m_width + qx;
+					float colorDist = pow2(cp[0] - compress(src[q * 3 + 0]))
+						+ pow2(cp[1] - compress(src[q * 3 + 1]))
+						+ pow2(cp[2] - compress(src[q * 3 + 2]));
+					float normalDist = lengthSqr(normal[p] - normal[q]);
+					float depthDist = pow2(depth[p] - depth[q]);
+					float albedoDist = lengthSqr(albedo[p] - albedo[q]);
+					float w = KERNEL[abs(dx)] * KERNEL[abs(dy)] * expf(-(colorDist * recipColor
+						+ normalDist * recipNormal + depthDist * recipDepth + albedoDist * recipAlbedo));
+					sum[0] += w * src[q * 3 + 0];
+					sum[1] += w * src[q * 3 + 1];
+					sum[2] += w * src[q * 3 + 2];
+					weightSum += w;
+				}
+			}
+			// The center tap always has weight KERNEL[0]^2, so weightSum > 0.
+			dst[p * 3 + 0] = sum[0] / weightSum;
+			dst[p * 3 + 1] = sum[1] / weightSum;
+			dst[p * 3 + 2] = sum[2] / weightSum;
+		}
+	}
+}
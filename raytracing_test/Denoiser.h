@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+#include "inline_math.h"
+
+namespace rayt {
+	// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) for low sample
+	// count previews. The radiance is divided by the first-hit albedo, smoothed with
+	// a 5x5 B3-spline kernel of growing stride whose taps are weighted by color,
+	// normal, depth and albedo similarity, and multiplied back, so texture and
+	// geometric edges survive. Every pass runs over tiles in parallel.
+	class Denoiser {
+	public:
+		static constexpr int TILE_SIZE = 64;
+		static constexpr int VARIANCE_RADIUS = 3;
+
+		Denoiser(int width, int height, int iterations = 5);
+
+		void setSigmas(float color, float normal, float depth, float albedo);
+		// out may alias color.
+		void apply(const Vector3 color[], const Vector3 albedo[], const Vector3 normal[], const float depth[], Vector3 out[]) const;
+
+	private:
+		void localVariance(int x0, int y0, int x1, int y1, const std::vector<float>& src, std::vector<float>& variance) const;
+		void pass(int x0, int y0, int x1, int y1, int stride, float sigmaColor,
+			const std::vector<float>& src, std::vector<float>& dst, const std::vector<float>& variance,
+			const Vector3 albedo[], const Vector3 normal[], const float depth[]) const;
+
+		int m_width;
+		int m_height;
+		int m_iterations;
+		float m_sigmaColor;
+		float m_sigmaNormal;
+		float m_sigmaDepth;
+		float m_sigmaAlbedo;
+	};
+}
@@ -0,0 +1,395 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <deque>
+#include <cstring>
+#include <algorithm>
+#include <omp.h>
+#include "Distributed.h"
+#include "Net.h"
+#include "Trace.h"
+
+using namespace rayt;
+
+namespace {
+	// Messages are a header and size bytes of payload, in the byte order of the
+	// machines, which is little-endian in practice.
+	enum MessageType : int32_t {
+		kHello = 1, // worker: int32 protocol version
+		kJob,       // coordinator: JobHeader, then passes x float { r, g, b, ior }
+		kRequest,   // worker: wants a tile
+		kLease,     // coordinator: Lease
+		kWait,      // coordinator: everything is leased, ask again later
+		kDone,      // coordinator: the job is finished
+		kResult     // worker: int32 unit, then the tile as float RGB, top row first
+	};
+
+	const int32_t PROTOCOL_VERSION = 1;
+	const int32_t MAX_MESSAGE = 1 << 28;
+	const int WAIT_MS = 200;
+	const int POLL_MS = 100;
+
+	struct Header {
+		int32_t type;
+		int32_t size;
+	};
+
+	struct JobHeader {
+		int32_t width;
+		int32_t height;
+		int32_t samples;
+		int32_t sampler;
+		int32_t integrator;
+		int32_t sceneType;
+		int32_t passes;
+	};
+
+	struct Lease {
+		int32_t unit;
+		int32_t pass;
+		int32_t x0, y0, x1, y1;
+	};
+
+	double now()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	bool sendMessage(Socket& socket, int32_t type, const void* payload = nullptr, size_t size = 0)
+	{
+		Header header = { type, int32_t(size) };
+		return socket.sendAll(&header, sizeof(header)) && (size == 0 || socket.sendAll(payload, size));
+	}
+
+	bool recvMessage(Socket& socket, int32_t& type, std::vector<char>& payload)
+	{
+		Header header;
+		if (!socket.recvAll(&header, sizeof(header)) || header.size < 0 || header.size > MAX_MESSAGE) {
+			return false;
+		}
+		type = header.type;
+		payload.resize(size_t(header.size));
+		return header.size == 0 || socket.recvAll(payload.data(), payload.size());
+	}
+
+	struct Unit {
+		Lease lease;
+		bool done;
+		double leasedAt;
+	};
+
+	struct Client {
+		Socket socket;
+		int unit; // Leased and not yet returned, -1 for none
+		std::vector<char> buffer; // Received, not yet a whole message
+	};
+
+	class Coordinator {
+	public:
+		Coordinator(const DistributedJob& job, std::vector<std::unique_ptr<Vector3[]>>& layers)
+			: m_job(job)
+			, m_layers(layers)
+			, m_done(0) {
+			const int pixelCount = job.width * job.height;
+			m_layers.clear();
+			for (size_t p = 0; p < job.rgb.size(); ++p) {
+				m_layers.push_back(std::make_unique<Vector3[]>(pixelCount));
+				for (int i = 0; i < pixelCount; ++i) {
+					m_layers.back()[i] = Vector3(0);
+				}
+				for (int y = 0; y < job.height; y += job.tileSize) {
+					for (int x = 0; x < job.width; x += job.tileSize) {
+						Lease lease = { int32_t(m_units.size()), int32_t(p), x, y,
+							std::min(x + job.tileSize, job.width), std::min(y + job.tileSize, job.height) };
+						m_pending.push_back(lease.unit);
+						m_units.push_back({ lease, false, 0 });
+					}
+				}
+			}
+		}
+
+		bool run(int port) {
+			Socket listener;
+			if (!listener.listen(port)) {
+				std::cerr << "failed to listen on port " << port << std::endl;
+				return false;
+			}
+			std::cout << "coordinator: " << m_units.size() << " tiles, waiting for workers on port " << port << std::endl;
+
+			// Once finished, workers are told so and the rest of their messages are
+			// drained until they disconnect, or for one more lease timeout.
+			double finishedAt = -1;
+			while (finishedAt < 0 || (!m_clients.empty() && now() - finishedAt < m_job.leaseTimeout)) {
+				std::vector<Socket*> sockets(1, &listener);
+				for (auto& c : m_clients) {
+					sockets.push_back(&c->socket);
+				}
+				std::vector<bool> readable;
+				if (!Socket::wait(sockets, POLL_MS, readable)) {
+					std::cerr << "coordinator: select failed" << std::endl;
+					return false;
+				}
+				if (readable[0]) {
+					Socket s = listener.accept();
+					if (s.valid()) {
+						m_clients.push_back(std::make_unique<Client>(Client{ std::move(s), -1, std::vector<char>() }));
+					}
+				}
+				for (size_t i = 1; i < readable.size(); ++i) {
+					Client& c = *m_clients[i - 1];
+					if (readable[i] && !serve(c)) {
+						release(c, "disconnected");
+						c.socket.close();
+					}
+				}
+				m_clients.erase(std::remove_if(m_clients.begin(), m_clients.end(),
+					[](const std::unique_ptr<Client>& c) { return !c->socket.valid(); }), m_clients.end());
+
+				const double t = now();
+				for (auto& c : m_clients) {
+					if (c->unit >= 0 && t - m_units[c->unit].leasedAt > m_job.leaseTimeout) {
+						release(*c, "timed out");
+					}
+				}
+
+				if (finishedAt < 0 && m_done == m_units.size()) {
+					finishedAt = t;
+					for (auto& c : m_clients) {
+						sendMessage(c->socket, kDone);
+					}
+				}
+			}
+			return true;
+		}
+
+	private:
+		// Puts a leased tile of c back in the queue.
+		void release(Client& c, const char* reason) {
+			if (c.unit >= 0 && !m_units[c.unit].done) {
+				std::cout << "coordinator: tile " << c.unit << " " << reason << ", leasing it again" << std::endl;
+				m_pending.push_front(c.unit);
+			}
+			c.unit = -1;
+		}
+
+		// Reads what has arrived and handles every complete message, so a worker that
+		// stalls partway through one never blocks the others; its lease times out.
+		// False once the client is gone or breaks the protocol.
+		bool serve(Client& c) {
+			char data[1 << 16];
+			int received = c.socket.recvSome(data, sizeof(data));
+			if (received <= 0) {
+				return false;
+			}
+			c.buffer.insert(c.buffer.end(), data, data + received);
+			size_t used = 0;
+			Header header;
+			while (c.buffer.size() - used >= sizeof(header)) {
+				memcpy(&header, c.buffer.data() + used, sizeof(header));
+				if (header.size < 0 || header.size > MAX_MESSAGE) {
+					return false;
+				}
+				if (c.buffer.size() - used - sizeof(header) < size_t(header.size)) {
+					break;
+				}
+				const char* begin = c.buffer.data() + used + sizeof(header);
+				std::vector<char> payload(begin, begin + header.size);
+				used += sizeof(header) + size_t(header.size);
+				if (!handle(c, header.type, payload)) {
+					return false;
+				}
+			}
+			c.buffer.erase(c.buffer.begin(), c.buffer.begin() + used);
+			return true;
+		}
+
+		bool handle(Client& c, int32_t type, const std::vector<char>& payload) {
+			switch (type) {
+			case kHello: {
+				int32_t version = 0;
+				if (payload.size() != sizeof(version)) {
+					return false;
+				}
+				memcpy(&version, payload.data(), sizeof(version));
+				if (version != PROTOCOL_VERSION) {
+					std::cerr << "coordinator: worker speaks protocol " << version << ", not " << PROTOCOL_VERSION << std::endl;
+					return false;
+				}
+				return sendJob(c);
+			}
+			case kRequest: {
+				// A worker holds one lease at a time; asking again gives up the last.
+				release(c, "abandoned");
+				if (m_done == m_units.size()) {
+					return sendMessage(c.socket, kDone);
+				}
+				while (!m_pending.empty() && m_units[m_pending.front()].done) {
+					m_pending.pop_front();
+				}
+				if (m_pending.empty()) {
+					return sendMessage(c.socket, kWait);
+				}
+				Unit& unit = m_units[m_pending.front()];
+				m_pending.pop_front();
+				unit.leasedAt = now();
+				c.unit = unit.lease.unit;
+				return sendMessage(c.socket, kLease, &unit.lease, sizeof(unit.lease));
+			}
+			case kResult:
+				return accept(c, payload);
+			default:
+				return false;
+			}
+		}
+
+		bool sendJob(Client& c) {
+			JobHeader header = { m_job.width, m_job.height, m_job.samples, m_job.sampler, m_job.integrator, m_job.sceneType, int32_t(m_job.rgb.size()) };
+			std::vector<char> payload(sizeof(header) + m_job.rgb.size() * 4 * sizeof(float));
+			memcpy(payload.data(), &header, sizeof(header));
+			float* params = reinterpret_cast<float*>(payload.data() + sizeof(header));
+			for (size_t p = 0; p < m_job.rgb.size(); ++p) {
+				params[p * 4 + 0] = m_job.rgb[p].getX();
+				params[p * 4 + 1] = m_job.rgb[p].getY();
+				params[p * 4 + 2] = m_job.rgb[p].getZ();
+				params[p * 4 + 3] = m_job.ior[p];
+			}
+			return sendMessage(c.socket, kJob, payload.data(), payload.size());
+		}
+
+		bool accept(Client& c, const std::vector<char>& payload) {
+			int32_t id = -1;
+			if (payload.size() >= sizeof(id)) {
+				memcpy(&id, payload.data(), sizeof(id));
+			}
+			if (id < 0 || id >= int32_t(m_units.size())) {
+				return false;
+			}
+			Unit& unit = m_units[id];
+			const Lease& l = unit.lease;
+			const int tw = l.x1 - l.x0;
+			const size_t pixels = size_t(tw) * (l.y1 - l.y0);
+			if (payload.size() != sizeof(id) + pixels * 3 * sizeof(float)) {
+				return false;
+			}
+			if (c.unit == id) {
+				c.unit = -1;
+			}
+			if (unit.done) {
+				return true; // A lease that timed out, finished by someone else first
+			}
+			const float* rgb = reinterpret_cast<const float*>(payload.data() + sizeof(id));
+			Vector3* layer = m_layers[l.pass].get();
+			for (int y = l.y0; y < l.y1; ++y) {
+				for (int x = l.x0; x < l.x1; ++x) {
+					const float* p = rgb + (size_t(tw) * (y - l.y0) + (x - l.x0)) * 3;
+					layer[size_t(y) * m_job.width + x] = Vector3(p[0], p[1], p[2]);
+				}
+			}
+			unit.done = true;
+			++m_done;
+			if (m_done * 10 / m_units.size() != (m_done - 1) * 10 / m_units.size()) {
+				std::cout << "coordinator: " << m_done << " / " << m_units.size() << " tiles, " << m_clients.size() << " workers" << std::endl;
+			}
+			return true;
+		}
+
+		const DistributedJob& m_job;
+		std::vector<std::unique_ptr<Vector3[]>>& m_layers;
+		std::vector<Unit> m_units;
+		std::deque<int> m_pending;
+		std::vector<std::unique_ptr<Client>> m_clients;
+		size_t m_done;
+	};
+}
+
+bool rayt::runCoordinator(const DistributedJob& job, int port, std::vector<std::unique_ptr<Vector3[]>>& layers)
+{
+	Coordinator coordinator(job, layers);
+	return coordinator.run(port);
+}
+
+bool rayt::runWorker(const std::string& host, int port, int threads)
+{
+	Socket socket;
+	if (!socket.connect(host, port)) {
+		std::cerr << "worker: failed to connect to " << host << ":" << port << std::endl;
+		return false;
+	}
+	int32_t type;
+	std::vector<char> payload;
+	JobHeader job;
+	if (!sendMessage(socket, kHello, &PROTOCOL_VERSION, sizeof(PROTOCOL_VERSION))
+		|| !recvMessage(socket, type, payload) || type != kJob || payload.size() < sizeof(job)) {
+		std::cerr << "worker: no job from " << host << ":" << port << std::endl;
+		return false;
+	}
+	memcpy(&job, payload.data(), sizeof(job));
+	if (job.passes <= 0 || payload.size() != sizeof(job) + size_t(job.passes) * 4 * sizeof(float)) {
+		return false;
+	}
+	std::vector<float> params(size_t(job.passes) * 4);
+	memcpy(params.data(), payload.data() + sizeof(job), params.size() * sizeof(float));
+	std::cout << "worker: " << job.width << "x" << job.height << " " << job.samples << " spp, " << job.passes << " passes" << std::endl;
+
+	// Every thread keeps its own built scene of each pass it has rendered.
+	std::vector<std::vector<std::unique_ptr<Scene>>> scenes(job.passes);
+	std::vector<float> result;
+	int tiles = 0;
+	for (;;) {
+		if (!sendMessage(socket, kRequest) || !recvMessage(socket, type, payload)) {
+			std::cerr << "worker: lost the coordinator after " << tiles << " tiles" << std::endl;
+			return false;
+		}
+		if (type == kDone) {
+			std::cout << "worker: done, " << tiles << " tiles" << std::endl;
+			return true;
+		}
+		if (type == kWait) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(WAIT_MS));
+			continue;
+		}
+		Lease lease;
+		if (type != kLease || payload.size() != sizeof(lease)) {
+			return false;
+		}
+		memcpy(&lease, payload.data(), sizeof(lease));
+		if (lease.pass < 0 || lease.pass >= job.passes) {
+			return false;
+		}
+		TraceScope trace("lease", lease.unit);
+
+		const int tw = lease.x1 - lease.x0;
+		auto tile = std::make_unique<Vector3[]>(size_t(tw) * (lease.y1 - lease.y0));
+		auto& passScenes = scenes[lease.pass];
+		passScenes.resize(threads);
+#pragma omp parallel num_threads(threads)
+		{
+			std::unique_ptr<Scene>& scene = passScenes[omp_get_thread_num()];
+			if (!scene) {
+				const float* p = params.data() + size_t(lease.pass) * 4;
+				scene = std::make_unique<Scene>(job.width, job.height, job.samples, SamplerType(job.sampler));
+				scene->setSceneType(SceneType(job.sceneType));
+				scene->setIntegrator(IntegratorType(job.integrator));
+				scene->build(p[0], p[1], p[2], p[3]);
+			}
+#pragma omp for schedule(dynamic)
+			for (int y = lease.y0; y < lease.y1; ++y) {
+				scene->renderTile(lease.x0, y, lease.x1, y + 1, tile.get() + size_t(tw) * (y - lease.y0));
+			}
+		}
+
+		const size_t pixels = size_t(tw) * (lease.y1 - lease.y0);
+		result.resize(1 + pixels * 3);
+		memcpy(result.data(), &lease.unit, sizeof(lease.unit));
+		for (size_t i = 0; i < pixels; ++i) {
+			result[1 + i * 3 + 0] = tile[i].getX();
+			result[1 + i * 3 + 1] = tile[i].getY();
+			result[1 + i * 3 + 2] = tile[i].getZ();
+		}
+		if (!sendMessage(socket, kResult, result.data(), result.size() * sizeof(float))) {
+			std::cerr << "worker: lost the coordinator after " << tiles << " tiles" << std::endl;
+			return false;
+		}
+		++tiles;
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "Scene.h"
+
+namespace rayt {
+	// A render split into tiles of every wavelength pass. The coordinator holds
+	// the job and leases one tile at a time to each connected worker; tiles that
+	// are not returned within leaseTimeout seconds, or whose worker disconnects,
+	// are leased again. Rendering does not depend on the worker, so the first
+	// result of a tile is kept.
+	struct DistributedJob {
+		int width;
+		int height;
+		int samples;
+		int tileSize;
+		SamplerType sampler;
+		IntegratorType integrator; // kPathTracing or kBDPT
+		SceneType sceneType;
+		std::vector<Vector3> rgb;  // Light color of every wavelength pass
+		std::vector<float> ior;    // Prism IOR of every wavelength pass
+		double leaseTimeout;
+	};
+
+	// Serves workers on port until every tile is back; layers then hold one
+	// image per wavelength pass, top row first.
+	bool runCoordinator(const DistributedJob& job, int port, std::vector<std::unique_ptr<Vector3[]>>& layers);
+
+	// Renders tiles leased from the coordinator at host:port with threads
+	// threads, until it reports the job finished or goes away.
+	bool runWorker(const std::string& host, int port, int threads);
+}
@@ -0,0 +1,299 @@
+#pragma once
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "inline_math.h"
+
+namespace rayt {
+	inline uint16_t float_to_half(float f) {
+		uint32_t x;
+		memcpy(&x, &f, sizeof(x));
+		uint32_t sign = (x >> 16) & 0x8000;
+		uint32_t mant = x & 0x7fffff;
+		int exp = int((x >> 23) & 0xff);
+		if (exp == 255) {
+			return uint16_t(sign | 0x7c00 | (mant ? 0x200 : 0));
+		}
+		int e = exp - 127 + 15;
+		if (e >= 31) {
+			return uint16_t(sign | 0x7c00);
+		}
+		if (e <= 0) {
+			if (e < -10) {
+				return uint16_t(sign);
+			}
+			mant |= 0x800000;
+			int shift = 14 - e;
+			uint32_t h = mant >> shift;
+			uint32_t rem = mant & ((1u << shift) - 1);
+			uint32_t halfway = 1u << (shift - 1);
+			if (rem > halfway || (rem == halfway && (h & 1))) ++h;
+			return uint16_t(sign | h);
+		}
+		uint32_t h = (uint32_t(e) << 10) | (mant >> 13);
+		uint32_t rem = mant & 0x1fff;
+		if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) ++h;
+		return uint16_t(sign | h);
+	}
+
+	inline int64_t file_tell(FILE* fp) {
+#ifdef _MSC_VER
+		return _ftelli64(fp);
+#else
+		return ftello(fp);
+#endif
+	}
+
+	inline int file_seek(FILE* fp, int64_t offset) {
+#ifdef _MSC_VER
+		return _fseeki64(fp, offset, SEEK_SET);
+#else
+		return fseeko(fp, offset, SEEK_SET);
+#endif
+	}
+
+	//--------------------------------------------------------------------------------
+
+	// Uncompressed, tiled, single-part OpenEXR output.
+	// Every layer is stored as "<layer>.R/G/B" channels in linear light, and every
+	// scalar layer as a single channel of that name (e.g. "Z").
+	// Tiles may be written in any order; the offset table is patched on close().
+	class ExrWriter {
+	public:
+		enum PixelType {
+			kHalf = 1,
+			kFloat = 2
+		};
+
+		ExrWriter() : m_fp(nullptr) { }
+		~ExrWriter() { close(); }
+
+		bool open(const std::string& path, int width, int height,
+			const std::vector<std::string>& layers, PixelType type = kFloat, int tileSize = 64,
+			const std::vector<std::string>& scalarLayers = std::vector<std::string>()) {
+			close();
+#ifdef _MSC_VER
+			if (fopen_s(&m_fp, path.c_str(), "wb") != 0) m_fp = nullptr;
+#else
+			m_fp = fopen(path.c_str(), "wb");
+#endif
+			if (!m_fp) {
+				return false;
+			}
+			m_width = width;
+			m_height = height;
+			m_type = type;
+			m_tileSize = tileSize;
+			m_numTilesX = (width + tileSize - 1) / tileSize;
+			m_numTilesY = (height + tileSize - 1) / tileSize;
+			m_numLayers = int(layers.size());
+			m_numScalarLayers = int(scalarLayers.size());
+
+			m_channels.clear();
+			const char* comps = "RGB";
+			for (int l = 0; l < m_numLayers; ++l) {
+				for (int c = 0; c < 3; ++c) {
+					m_channels.push_back({ layers[l] + "." + comps[c], l, c });
+				}
+			}
+			for (int l = 0; l < m_numScalarLayers; ++l) {
+				m_channels.push_back({ scalarLayers[l], l, -1 });
+			}
+			std::sort(m_channels.begin(), m_channels.end(),
+				[](const Channel& a, const Channel& b) { return a.name < b.name; });
+
+			bool longNames = false;
+			for (auto& ch : m_channels) {
+				longNames |= ch.name.size() > 31;
+			}
+
+			putU32(20000630);
+			putU32(2 | 0x200 | (longNames ? 0x400 : 0));
+
+			std::vector<char> chlist;
+			for (auto& ch : m_channels) {
+				chlist.insert(chlist.end(), ch.name.begin(), ch.name.end());
+				chlist.push_back(0);
+				appendU32(chlist, uint32_t(m_type));
+				chlist.insert(chlist.end(), 4, 0); // pLinear + reserved
+				appendU32(chlist, 1);
+				appendU32(chlist, 1);
+			}
+			chlist.push_back(0);
+			putAttr("channels", "chlist", chlist);
+
+			putAttr("compression", "compression", { 0 });
+
+			std::vector<char> box;
+			appendU32(box, 0);
+			appendU32(box, 0);
+			appendU32(box, uint32_t(width - 1));
+			appendU32(box, uint32_t(height - 1));
+			putAttr("dataWindow", "box2i", box);
+			putAttr("displayWindow", "box2i", box);
+
+			putAttr("lineOrder", "lineOrder", { 2 }); // RANDOM_Y
+
+			std::vector<char> one;
+			appendF32(one, 1.f);
+			putAttr("pixelAspectRatio", "float", one);
+
+			std::vector<char> center;
+			appendF32(center, 0.f);
+			appendF32(center, 0.f);
+			putAttr("screenWindowCenter", "v2f", center);
+			putAttr("screenWindowWidth", "float", one);
+
+			std::vector<char> tiles;
+			appendU32(tiles, uint32_t(tileSize));
+			appendU32(tiles, uint32_t(tileSize));
+			tiles.push_back(0); // ONE_LEVEL, ROUND_DOWN
+			putAttr("tiles", "tiledesc", tiles);
+
+			fputc(0, m_fp);
+
+			m_offsetTablePos = file_tell(m_fp);
+			m_offsets.assign(size_t(m_numTilesX) * m_numTilesY, 0);
+			fwrite(m_offsets.data(), sizeof(uint64_t), m_offsets.size(), m_fp);
+			return true;
+		}
+
+		// layers[l] points at the tile's top-left pixel of layer l; stride is the row pitch in pixels.
+		bool writeTile(int tx, int ty, const std::vector<const Vector3*>& layers, int stride,
+			const std::vector<const float*>& scalarLayers = std::vector<const float*>()) {
+			if (!m_fp || int(layers.size()) != m_numLayers || int(scalarLayers.size()) != m_numScalarLayers) {
+				return false;
+			}
+			int x0, y0, x1, y1;
+			tileBounds(tx, ty, x0, y0, x1, y1);
+			int tw = x1 - x0;
+			int th = y1 - y0;
+			int bytesPerSample = m_type == kHalf ? 2 : 4;
+
+			m_tileData.resize(size_t(tw) * th * m_channels.size() * bytesPerSample);
+			char* dst = m_tileData.data();
+			for (int y = 0; y < th; ++y) {
+				for (auto& ch : m_channels) {
+					const Vector3* row = ch.component >= 0 ? layers[ch.layer] + size_t(y) * stride : nullptr;
+					const float* scalarRow = ch.component < 0 ? scalarLayers[ch.layer] + size_t(y) * stride : nullptr;
+					for (int x = 0; x < tw; ++x) {
+						float v = row ? row[x][ch.component] : scalarRow[x];
+						if (m_type == kHalf) {
+							uint16_t h = float_to_half(v);
+							memcpy(dst, &h, 2);
+						}
+						else {
+							memcpy(dst, &v, 4);
+						}
+						dst += bytesPerSample;
+					}
+				}
+			}
+
+			m_offsets[size_t(ty) * m_numTilesX + tx] = uint64_t(file_tell(m_fp));
+			putU32(uint32_t(tx));
+			putU32(uint32_t(ty));
+			putU32(0);
+			putU32(0);
+			putU32(uint32_t(m_tileData.size()));
+			return fwrite(m_tileData.data(), 1, m_tileData.size(), m_fp) == m_tileData.size();
+		}
+
+		bool close() {
+			if (!m_fp) {
+				return false;
+			}
+			file_seek(m_fp, m_offsetTablePos);
+			fwrite(m_offsets.data(), sizeof(uint64_t), m_offsets.size(), m_fp);
+			bool ok = fclose(m_fp) == 0;
+			m_fp = nullptr;
+			return ok;
+		}
+
+		void tileBounds(int tx, int ty, int& x0, int& y0, int& x1, int& y1) const {
+			x0 = tx * m_tileSize;
+			y0 = ty * m_tileSize;
+			x1 = std::min(x0 + m_tileSize, m_width);
+			y1 = std::min(y0 + m_tileSize, m_height);
+		}
+
+		int tileSize() const { return m_tileSize; }
+		int numTilesX() const { return m_numTilesX; }
+		int numTilesY() const { return m_numTilesY; }
+
+	private:
+		struct Channel {
+			std::string name;
+			int layer;
+			int component; // -1 for scalar layers
+		};
+
+		static void appendU32(std::vector<char>& buf, uint32_t v) {
+			char b[4];
+			memcpy(b, &v, 4);
+			buf.insert(buf.end(), b, b + 4);
+		}
+		static void appendF32(std::vector<char>& buf, float v) {
+			char b[4];
+			memcpy(b, &v, 4);
+			buf.insert(buf.end(), b, b + 4);
+		}
+		void putU32(uint32_t v) {
+			fwrite(&v, 4, 1, m_fp);
+		}
+		void putAttr(const char* name, const char* type, const std::vector<char>& value) {
+			fwrite(name, 1, strlen(name) + 1, m_fp);
+			fwrite(type, 1, strlen(type) + 1, m_fp);
+			putU32(uint32_t(value.size()));
+			fwrite(value.data(), 1, value.size(), m_fp);
+		}
+
+		FILE* m_fp;
+		int m_width, m_height;
+		int m_tileSize;
+		int m_numTilesX, m_numTilesY;
+		int m_numLayers;
+		int m_numScalarLayers;
+		PixelType m_type;
+		std::vector<Channel> m_channels;
+		std::vector<uint64_t> m_offsets;
+		std::vector<char> m_tileData;
+		int64_t m_offsetTablePos;
+	};
+
+	//--------------------------------------------------------------------------------
+
+	// Writes whole framebuffers (width * height, top row first) as layers of one tiled EXR.
+	inline bool write_exr(const std::string& path, int width, int height,
+		const std::vector<std::string>& names, const std::vector<const Vector3*>& layers,
+		ExrWriter::PixelType type = ExrWriter::kFloat, int tileSize = 64,
+		const std::vector<std::string>& scalarNames = std::vector<std::string>(),
+		const std::vector<const float*>& scalarLayers = std::vector<const float*>()) {
+		ExrWriter exr;
+		if (!exr.open(path, width, height, names, type, tileSize, scalarNames)) {
+			return false;
+		}
+		std::vector<const Vector3*> tile(layers.size());
+		std::vector<const float*> scalarTile(scalarLayers.size());
+		for (int ty = 0; ty < exr.numTilesY(); ++ty) {
+			for (int tx = 0; tx < exr.numTilesX(); ++tx) {
+				int x0, y0, x1, y1;
+				exr.tileBounds(tx, ty, x0, y0, x1, y1);
+				for (size_t l = 0; l < layers.size(); ++l) {
+					tile[l] = layers[l] + size_t(y0) * width + x0;
+				}
+				for (size_t l = 0; l < scalarLayers.size(); ++l) {
+					scalarTile[l] = scalarLayers[l] + size_t(y0) * width + x0;
+				}
+				if (!exr.writeTile(tx, ty, tile, width, scalarTile)) {
+					exr.close();
+					return false;
+				}
+			}
+		}
+		return exr.close();
+	}
+}
@@ -1,5 +1,7 @@
 #pragma once
 #include <memory> // To use "unique_ptr"
+#include <vector>
+#include <algorithm>
 #include "inline_math.h"
 
 using namespace std;
@@ -57,6 +59,46 @@ namespace rayt {
 		return p;
 	}
 
+	// Uniform point in the unit ball from three sample dimensions, without rejection.
+	inline vec3 sample_in_unit_sphere(float u1, float u2, float u3) {
+		float z = 1.f - 2.f * u1;
+		float r = sqrtf(std::max(0.f, 1.f - z * z));
+		float phi = PI2 * u2;
+		return cbrtf(u3) * vec3(r * cosf(phi), r * sinf(phi), z);
+	}
+
+	// Cosine-weighted direction about +z from two sample dimensions, pdf = cos(theta) / PI.
+	inline vec3 sample_cosine_hemisphere(float u1, float u2) {
+		float r = sqrtf(u1);
+		float phi = PI2 * u2;
+		return vec3(r * cosf(phi), r * sinf(phi), sqrtf(std::max(0.f, 1.f - u1)));
+	}
+
+	// Orthonormal basis around a unit vector, without branches
+	// (Duff et al., "Building an Orthonormal Basis, Revisited", JCGT 2017).
+	class ONB {
+	public:
+		ONB(const vec3& n) {
+			float sign = copysignf(1.f, n.getZ());
+			float a = -1.f / (sign + n.getZ());
+			float b = n.getX() * n.getY() * a;
+			m_axis[0] = vec3(1.f + sign * n.getX() * n.getX() * a, sign * b, -sign * n.getX());
+			m_axis[1] = vec3(b, sign + n.getY() * n.getY() * a, -n.getY());
+			m_axis[2] = n;
+		}
+
+		const vec3& u() const { return m_axis[0]; }
+		const vec3& v() const { return m_axis[1]; }
+		const vec3& w() const { return m_axis[2]; }
+
+		vec3 local(const vec3& a) const {
+			return a.getX() * m_axis[0] + a.getY() * m_axis[1] + a.getZ() * m_axis[2];
+		}
+
+	private:
+		vec3 m_axis[3];
+	};
+
 	//--------------------------------------------------------------------------------
 
 	class ImageFilter {
@@ -99,7 +141,11 @@ namespace rayt {
 			}
 		};
 
-		Image() : m_pixels(nullptr) { }
+		// Filters only, for converting pixels with getWrite without a backing buffer.
+		Image() : m_width(0), m_height(0), m_pixels(nullptr) {
+			m_filters.push_back(make_unique<GammaFilter>(GAMMA_FACTOR));
+			m_filters.push_back(make_unique<TonemapFilter>());
+		}
 		Image(int w, int h) {
 			m_width = w;
 			m_height = h;
@@ -141,4 +187,65 @@ namespace rayt {
 		unique_ptr<rgb[]> m_pixels;
 		vector< unique_ptr<ImageFilter> > m_filters;
 	};
+
+	//--------------------------------------------------------------------------------
+
+	// Fused clamp + gamma + quantize for whole framebuffers, equivalent to the
+	// GammaFilter/TonemapFilter chain of Image::getWrite. The gamma curve is tabulated
+	// over s = sqrt(x), where x^(1/gamma) = s^(2/gamma) is close to linear, so a small
+	// table stays within a fraction of a code value even in the darks.
+	class ToneMapper {
+	public:
+		static constexpr int LUT_SIZE = 4096;
+		static constexpr int BATCH_SIZE = 64;
+
+		ToneMapper(float gammaFactor = GAMMA_FACTOR) {
+			float recipGammaFactor = recip(gammaFactor);
+			for (int i = 0; i < LUT_SIZE; ++i) {
+				float s = float(i) / float(LUT_SIZE - 1);
+				float c = std::min(powf(s * s, recipGammaFactor), 1.f);
+				m_lut[i] = static_cast<unsigned char>(c * 255.9f);
+			}
+		}
+
+		void apply(const Vector3* src, Image::rgb* dst, int count) const {
+			const int batchCount = (count + BATCH_SIZE - 1) / BATCH_SIZE;
+#pragma omp parallel for schedule(static)
+			for (int b = 0; b < batchCount; ++b) {
+				const int begin = b * BATCH_SIZE;
+				const int n = std::min(BATCH_SIZE, count - begin);
+				applyBatch(src + begin, dst + begin, n);
+			}
+		}
+
+	private:
+		void applyBatch(const Vector3* src, Image::rgb* dst, int n) const {
+			float c[3][BATCH_SIZE];
+			int index[3][BATCH_SIZE];
+			for (int i = 0; i < n; ++i) {
+				c[0][i] = src[i].getX();
+				c[1][i] = src[i].getY();
+				c[2][i] = src[i].getZ();
+			}
+			const float scale = float(LUT_SIZE - 1);
+			for (int k = 0; k < 3; ++k) {
+#if defined(_OPENMP) && _OPENMP >= 201307 // MSVC /openmp is OpenMP 2.0
+#pragma omp simd
+#endif
+				for (int i = 0; i < n; ++i) {
+					float x = c[k][i];
+					x = x > 0.f ? x : 0.f; // also maps NaN to 0
+					x = x < 1.f ? x : 1.f;
+					index[k][i] = int(sqrtf(x) * scale + 0.5f);
+				}
+			}
+			for (int i = 0; i < n; ++i) {
+				dst[i].r = m_lut[index[0][i]];
+				dst[i].g = m_lut[index[1][i]];
+				dst[i].b = m_lut[index[2][i]];
+			}
+		}
+
+		unsigned char m_lut[LUT_SIZE];
+	};
 }
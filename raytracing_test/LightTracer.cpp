@@ -0,0 +1,121 @@
+#include <omp.h>
+#include <cfloat>
+#include "LightTracer.h"
+#include "Scene.h"
+#include "Camera.h"
+#include "Shape.h"
+
+using namespace rayt;
+
+LightTracer::LightTracer(const Scene& scene)
+	: m_scene(scene)
+	, m_paths(0) { }
+
+LightTracer::~LightTracer() = default;
+
+void LightTracer::run(size_t paths)
+{
+	const Shape* world = m_scene.world();
+	const vec3 eye = m_scene.camera().origin();
+
+	m_framebuffers.resize(SLICES);
+#pragma omp parallel
+	{
+		SamplerPtr sampler = createSampler(m_scene.samplerType() == kRandomSampler ? kRandomSampler : kSobolSampler,
+			m_scene.width(), m_scene.height(), 1);
+
+		// Slice s always gets the same paths and framebuffer, whichever thread runs it.
+#pragma omp for schedule(dynamic, 1)
+		for (int s = 0; s < SLICES; ++s) {
+			std::vector<float>& framebuffer = m_framebuffers[s];
+			framebuffer.resize(size_t(m_scene.width()) * m_scene.height() * 3, 0.f);
+			const long long first = (long long)(paths * s / SLICES);
+			const long long last = (long long)(paths * (s + 1) / SLICES);
+			for (long long k = first; k < last; ++k) {
+				sampler->start(-1, -1, int(m_paths + k));
+				HitRec lrec;
+				float pdf;
+				if (!m_scene.sampleLight(*sampler, lrec, pdf)) {
+					continue;
+				}
+
+				// The light itself, seen directly
+				vec3 le = lrec.mat->emitted(Ray(lrec.p, lrec.n), lrec) / pdf;
+				if (dot(eye - lrec.p, lrec.n) > 0.f) {
+					splat(framebuffer, lrec.p, lrec.n, le);
+				}
+
+				float u1, u2;
+				sampler->get2D(u1, u2);
+				Ray r(lrec.p, ONB(lrec.n).local(sample_cosine_hemisphere(u1, u2)));
+				vec3 beta = le * PI;
+				for (int depth = 0; depth < MAX_DEPTH; ++depth) {
+					HitRec hrec;
+					RenderStats::countRay(false);
+					if (!world->hit(r, 0.001, FLT_MAX, hrec)) {
+						break;
+					}
+					if (!hrec.mat->isSpecular()) {
+						vec3 f = hrec.mat->eval(hrec, normalize(eye - hrec.p), -normalize(r.direction()));
+						splat(framebuffer, hrec.p, hrec.n, mulPerElem(beta, f));
+					}
+					ScatterRec srec;
+					if (!hrec.mat->scatter(r, hrec, srec, *sampler)) {
+						break;
+					}
+					beta = mulPerElem(beta, srec.albedo);
+					r = srec.ray;
+				}
+			}
+		}
+	}
+	m_paths += paths;
+}
+
+void LightTracer::splat(std::vector<float>& framebuffer, const vec3& p, const vec3& n, const vec3& value) const
+{
+	if (value.getX() == 0.f && value.getY() == 0.f && value.getZ() == 0.f) {
+		return;
+	}
+	const int nx = m_scene.width();
+	const int ny = m_scene.height();
+	float u, v;
+	float we = m_scene.camera().project(p, u, v);
+	if (we == 0.f) {
+		return;
+	}
+	vec3 d = m_scene.camera().origin() - p;
+	float dist = length(d);
+	HitRec hrec;
+	RenderStats::countRay(false);
+	if (m_scene.world()->hit(Ray(p, d / dist), 0.001f, dist - 0.001f, hrec)) {
+		return;
+	}
+	// Pixel importance is the film importance scaled up by the pixel count.
+	vec3 c = value * (we * fabsf(dot(n, d)) / (dist * pow2(dist)) * float(nx * ny));
+	const int i = std::min(int(u * nx), nx - 1);
+	const int j = std::min(int(v * ny), ny - 1);
+	float* px = &framebuffer[(size_t(nx) * (ny - j - 1) + i) * 3];
+	px[0] += c.getX();
+	px[1] += c.getY();
+	px[2] += c.getZ();
+}
+
+void LightTracer::resolve(Vector3 image[]) const
+{
+	const float scale = 1.f / float(std::max<size_t>(m_paths, 1));
+	const long long pixelCount = (long long)m_scene.width() * m_scene.height();
+#pragma omp parallel for
+	for (long long i = 0; i < pixelCount; ++i) {
+		float c[3] = { 0, 0, 0 };
+		for (auto& framebuffer : m_framebuffers) {
+			if (framebuffer.empty()) {
+				continue;
+			}
+			c[0] += framebuffer[i * 3 + 0];
+			c[1] += framebuffer[i * 3 + 1];
+			c[2] += framebuffer[i * 3 + 2];
+		}
+		image[i] = vec3(c[0], c[1], c[2]) * scale;
+	}
+}
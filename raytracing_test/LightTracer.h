@@ -0,0 +1,35 @@
+#pragma once
+#include <vector>
+#include "inline_math.h"
+
+namespace rayt {
+	class Scene;
+
+	// Light tracing: paths start on the lights and every diffuse vertex is
+	// connected to the pinhole and splatted onto the pixel it projects to.
+	// L S* D E paths, the prism caustics, converge far faster than from the camera,
+	// but whatever the camera only sees through a specular surface is missing.
+	class LightTracer {
+	public:
+		// Paths are split into this many slices, each splatting into its own
+		// framebuffer, so the sums do not depend on the thread count. A multiple of
+		// common core counts keeps the threads evenly loaded.
+		static constexpr int SLICES = 48;
+
+		LightTracer(const Scene& scene);
+		~LightTracer();
+
+		// Traces `paths` more light paths into the per-thread framebuffers.
+		void run(size_t paths);
+		// Merges the framebuffers, normalized by the number of paths traced so far.
+		void resolve(Vector3 image[]) const;
+		size_t paths() const { return m_paths; }
+
+	private:
+		void splat(std::vector<float>& framebuffer, const vec3& p, const vec3& n, const vec3& value) const;
+
+		const Scene& m_scene;
+		size_t m_paths;
+		std::vector<std::vector<float>> m_framebuffers; // One RGB buffer per slice
+	};
+}
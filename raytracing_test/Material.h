@@ -3,6 +3,8 @@
 #include "inline_math.h"
 #include "Image.h"
 #include "Texture.h"
+#include "Sampler.h"
+#include "RenderStats.h"
 
 namespace rayt {
 	class Shape;
@@ -33,8 +35,16 @@ namespace rayt {
 
 	class Material {
 	public:
-		virtual bool scatter(const Ray& r, const HitRec& hrec, ScatterRec& srec) const = 0;
+		virtual bool scatter(const Ray& r, const HitRec& hrec, ScatterRec& srec, Sampler& sampler) const = 0;
 		virtual vec3 emitted(const Ray& r, const HitRec& hrec) const { return vec3(0); }
+		// BSDF value for light arriving from wi and leaving towards wo (both pointing away from p).
+		virtual vec3 eval(const HitRec& hrec, const vec3& wo, const vec3& wi) const { return vec3(0); }
+		// Solid angle density with which scatter() picks wi given wo.
+		virtual float pdf(const HitRec& hrec, const vec3& wo, const vec3& wi) const { return 0; }
+		// Delta scattering that cannot be evaluated, only sampled.
+		virtual bool isSpecular() const { return false; }
+		// Surface color for auxiliary buffers; white where there is no meaningful one.
+		virtual vec3 albedo(const HitRec& hrec) const { return vec3(1); }
 	};
 
 	//----------------------------------------------------------------------------
@@ -44,12 +54,26 @@ namespace rayt {
 		Lambertian(const TexturePtr& a)
 			: m_albedo(a) {
 		}
-		virtual bool scatter(const Ray& r, const HitRec& hrec, ScatterRec& srec) const override {
-			vec3 target = hrec.p + hrec.n + random_in_uint_sphere();
-			srec.ray = Ray(hrec.p, target - hrec.p);
+		virtual bool scatter(const Ray& r, const HitRec& hrec, ScatterRec& srec, Sampler& sampler) const override {
+			RenderStats::countScatter(RenderStats::kLambertian);
+			float u1, u2;
+			sampler.get2D(u1, u2);
+			srec.ray = Ray(hrec.p, ONB(hrec.n).local(sample_cosine_hemisphere(u1, u2)));
 			srec.albedo = m_albedo->value(hrec.u, hrec.v, hrec.p);
 			return true;
 		}
+		virtual vec3 eval(const HitRec& hrec, const vec3& wo, const vec3& wi) const override {
+			if (dot(wi, hrec.n) <= 0 || dot(wo, hrec.n) <= 0) {
+				return vec3(0);
+			}
+			return m_albedo->value(hrec.u, hrec.v, hrec.p) * RECIP_PI;
+		}
+		virtual float pdf(const HitRec& hrec, const vec3& wo, const vec3& wi) const override {
+			return std::max(dot(wi, hrec.n), 0.f) * RECIP_PI;
+		}
+		virtual vec3 albedo(const HitRec& hrec) const override {
+			return m_albedo->value(hrec.u, hrec.v, hrec.p);
+		}
 	private:
 		TexturePtr m_albedo;
 	};
@@ -63,13 +87,20 @@ namespace rayt {
 			, m_fuzz(fuzz) {
 		}
 
-		virtual bool scatter(const Ray& r, const HitRec& hrec, ScatterRec& srec) const override {
+		virtual bool scatter(const Ray& r, const HitRec& hrec, ScatterRec& srec, Sampler& sampler) const override {
+			RenderStats::countScatter(RenderStats::kMetal);
 			vec3 reflected = reflect(normalize(r.direction()), hrec.n);
-			reflected += m_fuzz * random_in_uint_sphere();
+			float u1, u2;
+			sampler.get2D(u1, u2);
+			reflected += m_fuzz * sample_in_unit_sphere(u1, u2, sampler.get1D());
 			srec.ray = Ray(hrec.p, reflected);
 			srec.albedo = m_albedo->value(hrec.u, hrec.v, hrec.p);
 			return dot(srec.ray.direction(), hrec.n) > 0;
 		}
+		virtual bool isSpecular() const override { return true; }
+		virtual vec3 albedo(const HitRec& hrec) const override {
+			return m_albedo->value(hrec.u, hrec.v, hrec.p);
+		}
 
 	private:
 		TexturePtr m_albedo;
@@ -82,7 +113,11 @@ namespace rayt {
 			: m_ri(ri) {
 
 		}
-		virtual bool scatter(const Ray& r, const HitRec& hrec, ScatterRec& srec) const override {
+		// Not to be changed while the material is being rendered.
+		void setRefractiveIndex(float ri) { m_ri = ri; }
+		float refractiveIndex() const { return m_ri; }
+		virtual bool scatter(const Ray& r, const HitRec& hrec, ScatterRec& srec, Sampler& sampler) const override {
+			RenderStats::countScatter(RenderStats::kDielectric);
 
 			vec3 outward_normal;
 			vec3 reflected = reflect(r.direction(), hrec.n);
@@ -109,7 +144,7 @@ namespace rayt {
 				reflect_prob = 1;
 			}
 
-			if (drand48() < reflect_prob) {
+			if (sampler.get1D() < reflect_prob) {
 				srec.ray = Ray(hrec.p, reflected);
 			}
 			else {
@@ -118,6 +153,7 @@ namespace rayt {
 
 			return true;
 		}
+		virtual bool isSpecular() const override { return true; }
 
 	private:
 		float m_ri;
@@ -128,8 +164,11 @@ namespace rayt {
 		DiffuseLight(const TexturePtr& emit)
 			: m_emit(emit) {
 		}
+		// Not to be changed while the material is being rendered.
+		void setEmission(const TexturePtr& emit) { m_emit = emit; }
 
-		virtual bool scatter(const Ray& r, const HitRec& hrec, ScatterRec& srec) const override {
+		virtual bool scatter(const Ray& r, const HitRec& hrec, ScatterRec& srec, Sampler& sampler) const override {
+			RenderStats::countScatter(RenderStats::kDiffuseLight);
 			return false;
 		}
 
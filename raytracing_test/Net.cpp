@@ -0,0 +1,229 @@
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+#include <cstring>
+#include <algorithm>
+#include "Net.h"
+
+using namespace rayt;
+
+namespace {
+#ifdef _WIN32
+	typedef SOCKET Handle;
+	typedef int IoSize;
+	const uintptr_t INVALID = uintptr_t(INVALID_SOCKET);
+
+	void closeHandle(Handle h) { closesocket(h); }
+
+	// Winsock has to be started once per process before the first socket.
+	bool startup()
+	{
+		static const bool started = [] {
+			WSADATA data;
+			return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+		}();
+		return started;
+	}
+#else
+	typedef int Handle;
+	typedef size_t IoSize;
+	const uintptr_t INVALID = uintptr_t(-1);
+
+	void closeHandle(Handle h) { ::close(h); }
+	bool startup() { return true; }
+#endif
+
+#ifdef MSG_NOSIGNAL
+	const int SEND_FLAGS = MSG_NOSIGNAL; // A closed peer is an error, not SIGPIPE
+#else
+	const int SEND_FLAGS = 0;
+#endif
+
+	Handle handleOf(uintptr_t h) { return Handle(h); }
+
+	// Tiles are sent as soon as they are written, not after Nagle's delay.
+	void setNoDelay(Handle h)
+	{
+		int on = 1;
+		setsockopt(h, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+	}
+}
+
+Socket::Socket()
+	: m_handle(INVALID) { }
+
+Socket::Socket(uintptr_t handle)
+	: m_handle(handle) { }
+
+Socket::Socket(Socket&& other)
+	: m_handle(other.m_handle) {
+	other.m_handle = INVALID;
+}
+
+Socket& Socket::operator=(Socket&& other)
+{
+	if (this != &other) {
+		close();
+		m_handle = other.m_handle;
+		other.m_handle = INVALID;
+	}
+	return *this;
+}
+
+Socket::~Socket()
+{
+	close();
+}
+
+bool Socket::listen(int port, bool localOnly)
+{
+	close();
+	if (!startup()) {
+		return false;
+	}
+	Handle h = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (uintptr_t(h) == INVALID) {
+		return false;
+	}
+	m_handle = uintptr_t(h);
+	int on = 1;
+	setsockopt(h, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on));
+
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(localOnly ? INADDR_LOOPBACK : INADDR_ANY);
+	addr.sin_port = htons(static_cast<unsigned short>(port));
+	if (bind(h, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(h, SOMAXCONN) != 0) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+Socket Socket::accept()
+{
+	Handle h = ::accept(handleOf(m_handle), nullptr, nullptr);
+	if (uintptr_t(h) == INVALID) {
+		return Socket();
+	}
+	setNoDelay(h);
+	return Socket(uintptr_t(h));
+}
+
+bool Socket::connect(const std::string& host, int port)
+{
+	close();
+	if (!startup()) {
+		return false;
+	}
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* list = nullptr;
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &list) != 0) {
+		return false;
+	}
+	for (addrinfo* ai = list; ai; ai = ai->ai_next) {
+		Handle h = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (uintptr_t(h) == INVALID) {
+			continue;
+		}
+		if (::connect(h, ai->ai_addr, static_cast<int>(ai->ai_addrlen)) == 0) {
+			setNoDelay(h);
+			m_handle = uintptr_t(h);
+			break;
+		}
+		closeHandle(h);
+	}
+	freeaddrinfo(list);
+	return valid();
+}
+
+void Socket::close()
+{
+	if (valid()) {
+		closeHandle(handleOf(m_handle));
+		m_handle = INVALID;
+	}
+}
+
+bool Socket::valid() const
+{
+	return m_handle != INVALID;
+}
+
+bool Socket::sendAll(const void* data, size_t size)
+{
+	const char* p = static_cast<const char*>(data);
+	while (size > 0) {
+		IoSize chunk = IoSize(std::min<size_t>(size, 1 << 20));
+		auto sent = send(handleOf(m_handle), p, chunk, SEND_FLAGS);
+		if (sent <= 0) {
+			return false;
+		}
+		p += sent;
+		size -= size_t(sent);
+	}
+	return true;
+}
+
+bool Socket::recvAll(void* data, size_t size)
+{
+	char* p = static_cast<char*>(data);
+	while (size > 0) {
+		IoSize chunk = IoSize(std::min<size_t>(size, 1 << 20));
+		auto received = recv(handleOf(m_handle), p, chunk, 0);
+		if (received <= 0) {
+			return false;
+		}
+		p += received;
+		size -= size_t(received);
+	}
+	return true;
+}
+
+int Socket::recvSome(void* data, size_t size)
+{
+	IoSize chunk = IoSize(std::min<size_t>(size, 1 << 20));
+	return int(recv(handleOf(m_handle), static_cast<char*>(data), chunk, 0));
+}
+
+bool Socket::wait(const std::vector<Socket*>& sockets, int timeoutMs, std::vector<bool>& readable)
+{
+	fd_set set;
+	FD_ZERO(&set);
+	int maxFd = -1;
+	for (Socket* s : sockets) {
+		if (s->valid()) {
+			FD_SET(handleOf(s->m_handle), &set);
+			maxFd = std::max(maxFd, int(s->m_handle));
+		}
+	}
+	timeval timeout;
+	timeout.tv_sec = timeoutMs / 1000;
+	timeout.tv_usec = (timeoutMs % 1000) * 1000;
+	// The first argument is ignored by winsock.
+	int ready = select(maxFd + 1, &set, nullptr, nullptr, &timeout);
+	readable.assign(sockets.size(), false);
+	if (ready < 0) {
+		return false;
+	}
+	for (size_t i = 0; i < sockets.size(); ++i) {
+		readable[i] = sockets[i]->valid() && FD_ISSET(handleOf(sockets[i]->m_handle), &set);
+	}
+	return true;
+}
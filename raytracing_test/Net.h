@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace rayt {
+	// Blocking TCP socket over winsock or BSD sockets. Sockets are move-only and
+	// closed by their destructor.
+	class Socket {
+	public:
+		Socket();
+		Socket(Socket&& other);
+		Socket& operator=(Socket&& other);
+		~Socket();
+
+		// Listens on every interface, or on loopback only.
+		bool listen(int port, bool localOnly = false);
+		// Waits for the next connection to a listening socket; invalid on failure.
+		Socket accept();
+		bool connect(const std::string& host, int port);
+		void close();
+		bool valid() const;
+
+		// Both fail when the connection is closed or broken.
+		bool sendAll(const void* data, size_t size);
+		bool recvAll(void* data, size_t size);
+		// Reads whatever has arrived, up to size bytes, waiting for at least one.
+		// Returns 0 when the peer closed the connection, negative on error.
+		int recvSome(void* data, size_t size);
+
+		// Waits up to timeoutMs for any of sockets to become readable, or to be
+		// closed by the peer, and flags those. Returns false on error.
+		static bool wait(const std::vector<Socket*>& sockets, int timeoutMs, std::vector<bool>& readable);
+
+	private:
+		explicit Socket(uintptr_t handle);
+		Socket(const Socket&) = delete;
+		Socket& operator=(const Socket&) = delete;
+
+		uintptr_t m_handle;
+	};
+}
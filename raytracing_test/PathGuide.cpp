@@ -0,0 +1,246 @@
+#include <cmath>
+#include <algorithm>
+#include "PathGuide.h"
+
+using namespace rayt;
+
+namespace {
+	// Equal-area mapping between directions and the unit square
+	inline void dirToSquare(const vec3& dir, float& x, float& y)
+	{
+		x = saturate((dir.getZ() + 1.f) * 0.5f);
+		float phi = atan2f(dir.getY(), dir.getX());
+		if (phi < 0.f) {
+			phi += PI2;
+		}
+		y = saturate(phi * RECIP_PI2);
+	}
+
+	inline vec3 squareToDir(float x, float y)
+	{
+		float cosTheta = 2.f * x - 1.f;
+		float sinTheta = sqrtf(std::max(0.f, 1.f - cosTheta * cosTheta));
+		float phi = PI2 * y;
+		return vec3(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta);
+	}
+
+	inline float nextAfterOne(float u)
+	{
+		return std::min(u, 0.99999994f);
+	}
+}
+
+QuadTree::QuadTree()
+	: m_nodes(1, emptyNode()) { }
+
+QuadTree::Node QuadTree::emptyNode()
+{
+	return { { 0, 0, 0, 0 }, { -1, -1, -1, -1 } };
+}
+
+float QuadTree::nodeTotal(int node) const
+{
+	const Node& n = m_nodes[node];
+	return n.sum[0] + n.sum[1] + n.sum[2] + n.sum[3];
+}
+
+float QuadTree::total() const
+{
+	return nodeTotal(0);
+}
+
+void QuadTree::record(float x, float y, float value)
+{
+	int node = 0;
+	for (;;) {
+		int cx = x >= 0.5f ? 1 : 0;
+		int cy = y >= 0.5f ? 1 : 0;
+		int c = cx + 2 * cy;
+		float& sum = m_nodes[node].sum[c];
+#pragma omp atomic
+		sum += value;
+		node = m_nodes[node].child[c];
+		if (node < 0) {
+			break;
+		}
+		x = x * 2.f - cx;
+		y = y * 2.f - cy;
+	}
+}
+
+float QuadTree::pdf(float x, float y) const
+{
+	float pdf = 1.f;
+	int node = 0;
+	for (;;) {
+		float total = nodeTotal(node);
+		if (total <= 0.f) {
+			return pdf;
+		}
+		int cx = x >= 0.5f ? 1 : 0;
+		int cy = y >= 0.5f ? 1 : 0;
+		int c = cx + 2 * cy;
+		pdf *= 4.f * m_nodes[node].sum[c] / total;
+		node = m_nodes[node].child[c];
+		if (node < 0 || pdf == 0.f) {
+			return pdf;
+		}
+		x = x * 2.f - cx;
+		y = y * 2.f - cy;
+	}
+}
+
+void QuadTree::sample(float u1, float u2, float& x, float& y) const
+{
+	float ox = 0.f;
+	float oy = 0.f;
+	float size = 1.f;
+	int node = 0;
+	while (node >= 0) {
+		const Node& n = m_nodes[node];
+		float total = nodeTotal(node);
+		if (total <= 0.f) {
+			break;
+		}
+		// Pick the column, then the quadrant within it, reusing the random numbers.
+		float left = (n.sum[0] + n.sum[2]) / total;
+		int cx;
+		if (u1 < left) {
+			cx = 0;
+			u1 = nextAfterOne(u1 / left);
+		}
+		else {
+			cx = 1;
+			u1 = nextAfterOne((u1 - left) / (1.f - left));
+		}
+		float column = n.sum[cx] + n.sum[cx + 2];
+		float bottom = n.sum[cx] / column;
+		int cy;
+		if (u2 < bottom) {
+			cy = 0;
+			u2 = nextAfterOne(u2 / bottom);
+		}
+		else {
+			cy = 1;
+			u2 = nextAfterOne((u2 - bottom) / (1.f - bottom));
+		}
+		size *= 0.5f;
+		ox += cx * size;
+		oy += cy * size;
+		node = n.child[cx + 2 * cy];
+	}
+	x = ox + u1 * size;
+	y = oy + u2 * size;
+}
+
+void QuadTree::refine(const QuadTree& energy, float threshold, int maxDepth)
+{
+	m_nodes.assign(1, emptyNode());
+	float total = energy.total();
+	if (total > 0.f) {
+		refineNode(energy, 0, total, 0, 1, threshold * total, maxDepth);
+	}
+}
+
+void QuadTree::refineNode(const QuadTree& energy, int src, float share, int dst, int depth, float threshold, int maxDepth)
+{
+	if (depth >= maxDepth) {
+		return;
+	}
+	for (int c = 0; c < 4; ++c) {
+		// Below a source leaf its energy is assumed to be spread evenly.
+		float s = src >= 0 ? energy.m_nodes[src].sum[c] : share * 0.25f;
+		if (s <= threshold) {
+			continue;
+		}
+		int child = int(m_nodes.size());
+		m_nodes.push_back(emptyNode());
+		m_nodes[dst].child[c] = child;
+		refineNode(energy, src >= 0 ? energy.m_nodes[src].child[c] : -1, s, child, depth + 1, threshold, maxDepth);
+	}
+}
+
+//----------------------------------------------------------------------------
+
+PathGuide::PathGuide(const vec3& boundsMin, const vec3& boundsMax)
+	: m_boundsMin(boundsMin)
+	, m_boundsMax(boundsMax)
+	, m_nodes(1, SNode{ 0, -1, 0, 0.f })
+	, m_dtrees(1)
+	, m_iteration(0)
+	, m_training(true) { }
+
+int PathGuide::leaf(const vec3& p) const
+{
+	vec3 q = divPerElem(p - m_boundsMin, m_boundsMax - m_boundsMin);
+	float c[3] = { saturate(q.getX()), saturate(q.getY()), saturate(q.getZ()) };
+	int node = 0;
+	while (m_nodes[node].child >= 0) {
+		const SNode& n = m_nodes[node];
+		if (c[n.axis] < 0.5f) {
+			c[n.axis] *= 2.f;
+			node = n.child;
+		}
+		else {
+			c[n.axis] = c[n.axis] * 2.f - 1.f;
+			node = n.child + 1;
+		}
+	}
+	return node;
+}
+
+vec3 PathGuide::sample(const vec3& p, float u1, float u2) const
+{
+	float x, y;
+	m_dtrees[m_nodes[leaf(p)].dtree].sampling.sample(u1, u2, x, y);
+	return squareToDir(x, y);
+}
+
+float PathGuide::pdf(const vec3& p, const vec3& dir) const
+{
+	float x, y;
+	dirToSquare(dir, x, y);
+	return m_dtrees[m_nodes[leaf(p)].dtree].sampling.pdf(x, y) * (0.25f * RECIP_PI);
+}
+
+void PathGuide::record(const vec3& p, const vec3& dir, float value)
+{
+	if (!(value >= 0.f) || std::isinf(value)) {
+		return;
+	}
+	float x, y;
+	dirToSquare(dir, x, y);
+	SNode& node = m_nodes[leaf(p)];
+#pragma omp atomic
+	node.samples += 1.f;
+	m_dtrees[node.dtree].building.record(x, y, value);
+}
+
+void PathGuide::refine()
+{
+	// Split leaves that saw many samples; both halves start from a copy of the parent's distribution.
+	const float threshold = SPATIAL_THRESHOLD * sqrtf(float(1 << m_iteration));
+	for (size_t i = 0; i < m_nodes.size(); ++i) {
+		if (m_nodes[i].child >= 0 || m_nodes[i].samples <= threshold) {
+			continue;
+		}
+		const int axis = m_nodes[i].axis;
+		const int dtree = m_nodes[i].dtree;
+		const float samples = m_nodes[i].samples * 0.5f;
+		m_nodes[i].child = int(m_nodes.size());
+		m_nodes.push_back({ (axis + 1) % 3, -1, dtree, samples });
+		m_nodes.push_back({ (axis + 1) % 3, -1, int(m_dtrees.size()), samples });
+		m_dtrees.push_back(m_dtrees[dtree]);
+	}
+
+	for (auto& node : m_nodes) {
+		node.samples = 0.f;
+	}
+	for (auto& dtree : m_dtrees) {
+		QuadTree next;
+		next.refine(dtree.building, ENERGY_THRESHOLD, MAX_DIRECTIONAL_DEPTH);
+		dtree.sampling = std::move(dtree.building);
+		dtree.building = std::move(next);
+	}
+	++m_iteration;
+}
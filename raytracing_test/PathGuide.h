@@ -0,0 +1,85 @@
+#pragma once
+#include <vector>
+#include "inline_math.h"
+
+namespace rayt {
+	// Directional distribution over the unit square, which covers the sphere of
+	// directions through the equal-area (cos theta, phi) mapping. Each node holds the
+	// energy that fell into its four quadrants.
+	class QuadTree {
+	public:
+		QuadTree();
+
+		float total() const;
+		// Safe to call from several threads at once.
+		void record(float x, float y, float value);
+		// Density over the unit square, uniform while nothing has been recorded.
+		float pdf(float x, float y) const;
+		void sample(float u1, float u2, float& x, float& y) const;
+		// Rebuilds this tree with empty sums, subdividing wherever `energy` holds more
+		// than `threshold` of its total.
+		void refine(const QuadTree& energy, float threshold, int maxDepth);
+
+	private:
+		struct Node {
+			float sum[4];
+			int child[4]; // -1 for leaves
+		};
+
+		static Node emptyNode();
+		float nodeTotal(int node) const;
+		void refineNode(const QuadTree& energy, int src, float share, int dst, int depth, float threshold, int maxDepth);
+
+		std::vector<Node> m_nodes;
+	};
+
+	//----------------------------------------------------------------------------
+
+	// Path guiding with an SD-tree (Muller et al. 2017): a binary tree over space
+	// whose leaves hold a QuadTree of incident radiance. Each training iteration
+	// records into one set of trees while sampling from the previous one; refine()
+	// then splits busy regions and swaps them.
+	class PathGuide {
+	public:
+		static constexpr float SPATIAL_THRESHOLD = 12000.f; // Samples per leaf, scaled by sqrt(2^iteration)
+		static constexpr float ENERGY_THRESHOLD = 0.01f;
+		static constexpr int MAX_DIRECTIONAL_DEPTH = 20;
+		static constexpr float GUIDE_FRACTION = 0.5f; // Guided share of the diffuse samples
+
+		PathGuide(const vec3& boundsMin, const vec3& boundsMax);
+
+		// Nothing can be sampled before the first refine().
+		bool ready() const { return m_iteration > 0; }
+		bool training() const { return m_training; }
+		void setTraining(bool training) { m_training = training; }
+		int iteration() const { return m_iteration; }
+
+		vec3 sample(const vec3& p, float u1, float u2) const;
+		// Solid angle density of sample().
+		float pdf(const vec3& p, const vec3& dir) const;
+		// Radiance arriving at p from dir, divided by the density it was sampled with.
+		void record(const vec3& p, const vec3& dir, float value);
+		void refine();
+
+	private:
+		struct SNode {
+			int axis;  // Split axis
+			int child; // First of two children, -1 for leaves
+			int dtree;
+			float samples;
+		};
+		struct DTree {
+			QuadTree sampling;
+			QuadTree building;
+		};
+
+		int leaf(const vec3& p) const;
+
+		vec3 m_boundsMin;
+		vec3 m_boundsMax;
+		std::vector<SNode> m_nodes;
+		std::vector<DTree> m_dtrees;
+		int m_iteration;
+		bool m_training;
+	};
+}
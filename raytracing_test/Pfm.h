@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "inline_math.h"
+
+namespace rayt {
+	// Portable float map: a little-endian float RGB image, stored bottom row first.
+	// pixels are top row first, like every framebuffer of the renderer.
+	inline bool write_pfm(const std::string& path, int width, int height, const Vector3 pixels[]) {
+		FILE* fp = nullptr;
+#ifdef _MSC_VER
+		if (fopen_s(&fp, path.c_str(), "wb") != 0) fp = nullptr;
+#else
+		fp = fopen(path.c_str(), "wb");
+#endif
+		if (!fp) {
+			return false;
+		}
+		fprintf(fp, "PF\n%d %d\n-1.0\n", width, height);
+		std::vector<float> row(size_t(width) * 3);
+		for (int y = height - 1; y >= 0; --y) {
+			for (int x = 0; x < width; ++x) {
+				const Vector3& p = pixels[size_t(y) * width + x];
+				row[x * 3 + 0] = p.getX();
+				row[x * 3 + 1] = p.getY();
+				row[x * 3 + 2] = p.getZ();
+			}
+			fwrite(row.data(), sizeof(float), row.size(), fp);
+		}
+		return fclose(fp) == 0;
+	}
+
+	// Reads a little-endian RGB PFM into pixels, top row first.
+	inline bool read_pfm(const std::string& path, int& width, int& height, std::vector<Vector3>& pixels) {
+		FILE* fp = nullptr;
+#ifdef _MSC_VER
+		if (fopen_s(&fp, path.c_str(), "rb") != 0) fp = nullptr;
+#else
+		fp = fopen(path.c_str(), "rb");
+#endif
+		if (!fp) {
+			return false;
+		}
+		char magic[3] = {};
+		float scale = 0;
+#ifdef _MSC_VER
+		int fields = fscanf_s(fp, "%2s %d %d %f", magic, unsigned(sizeof(magic)), &width, &height, &scale);
+#else
+		int fields = fscanf(fp, "%2s %d %d %f", magic, &width, &height, &scale);
+#endif
+		bool ok = fields == 4 && std::string(magic) == "PF" && scale < 0 && width > 0 && height > 0;
+		if (ok) {
+			fgetc(fp); // The single whitespace before the data
+			pixels.resize(size_t(width) * height);
+			std::vector<float> row(size_t(width) * 3);
+			for (int y = height - 1; y >= 0 && ok; --y) {
+				ok = fread(row.data(), sizeof(float), row.size(), fp) == row.size();
+				for (int x = 0; x < width && ok; ++x) {
+					pixels[size_t(y) * width + x] = Vector3(row[x * 3 + 0], row[x * 3 + 1], row[x * 3 + 2]);
+				}
+			}
+		}
+		fclose(fp);
+		return ok;
+	}
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <utility>
+#include "Material.h"
+
+namespace rayt {
+	class Photon {
+	public:
+		vec3 p;     // Position on a diffuse surface
+		vec3 n;     // Surface normal at p
+		vec3 dir;   // Propagation direction
+		vec3 power; // Flux
+	};
+
+	// Photons tagged with the index of the path that deposited them, as collected per thread.
+	typedef std::vector<std::pair<long long, Photon>> TaggedPhotons;
+
+	// Concatenates the photons of all threads in path order (and deposit order
+	// within a path), so the map does not depend on thread count or scheduling.
+	inline std::vector<Photon> merge_photons(std::vector<TaggedPhotons>& stored) {
+		TaggedPhotons all;
+		for (auto& p : stored) {
+			all.insert(all.end(), p.begin(), p.end());
+			TaggedPhotons().swap(p);
+		}
+		std::stable_sort(all.begin(), all.end(),
+			[](const std::pair<long long, Photon>& a, const std::pair<long long, Photon>& b) { return a.first < b.first; });
+		std::vector<Photon> photons(all.size());
+		for (size_t i = 0; i < all.size(); ++i) {
+			photons[i] = all[i].second;
+		}
+		return photons;
+	}
+
+	//----------------------------------------------------------------------------
+
+	// Photons bucketed in a hashed uniform grid whose cells are one gather radius
+	// wide, so a lookup only visits the 3x3x3 cells around the query point.
+	class PhotonMap {
+	public:
+		PhotonMap() : m_cellSize(1), m_emitted(0) { }
+
+		void build(std::vector<Photon>&& photons, float radius, size_t emitted) {
+			m_cellSize = radius;
+			m_emitted = emitted;
+			size_t tableSize = 1;
+			while (tableSize < photons.size() * 2) tableSize <<= 1;
+			m_cellStart.assign(tableSize + 1, 0);
+
+			std::vector<uint32_t> cells(photons.size());
+			for (size_t i = 0; i < photons.size(); ++i) {
+				cells[i] = cellHash(cellCoord(photons[i].p.getX()), cellCoord(photons[i].p.getY()), cellCoord(photons[i].p.getZ()));
+				++m_cellStart[cells[i] + 1];
+			}
+			for (size_t c = 0; c < tableSize; ++c) {
+				m_cellStart[c + 1] += m_cellStart[c];
+			}
+			m_photons.resize(photons.size());
+			std::vector<uint32_t> fill(m_cellStart.begin(), m_cellStart.end() - 1);
+			for (size_t i = 0; i < photons.size(); ++i) {
+				m_photons[fill[cells[i]]++] = photons[i];
+			}
+			photons.clear();
+		}
+
+		void clear() {
+			m_photons.clear();
+			m_cellStart.clear();
+			m_emitted = 0;
+		}
+
+		size_t size() const { return m_photons.size(); }
+		size_t emitted() const { return m_emitted; }
+		float radius() const { return m_cellSize; }
+
+		// Reflected radiance towards wo from the photons within radius of hrec.p.
+		vec3 estimate(const HitRec& hrec, const vec3& wo, float radius) const {
+			vec3 flux(0);
+			gather(hrec.p, hrec.n, radius, [&](const Photon& ph) {
+				flux += mulPerElem(hrec.mat->eval(hrec, wo, -ph.dir), ph.power);
+			});
+			return flux * (RECIP_PI / pow2(radius));
+		}
+
+		// Calls f for every photon within radius (at most the build radius) of p
+		// lying on a surface facing n.
+		template <typename F>
+		void gather(const vec3& p, const vec3& n, float radius, F f) const {
+			if (m_photons.empty()) {
+				return;
+			}
+			const float r2 = pow2(radius);
+			int cx = cellCoord(p.getX());
+			int cy = cellCoord(p.getY());
+			int cz = cellCoord(p.getZ());
+			// Neighbouring cells may share a bucket; visit each bucket once.
+			uint32_t visited[27];
+			int visitedCount = 0;
+			for (int z = cz - 1; z <= cz + 1; ++z) {
+				for (int y = cy - 1; y <= cy + 1; ++y) {
+					for (int x = cx - 1; x <= cx + 1; ++x) {
+						uint32_t c = cellHash(x, y, z);
+						if (std::find(visited, visited + visitedCount, c) != visited + visitedCount) {
+							continue;
+						}
+						visited[visitedCount++] = c;
+						for (uint32_t i = m_cellStart[c]; i < m_cellStart[c + 1]; ++i) {
+							const Photon& ph = m_photons[i];
+							vec3 d = ph.p - p;
+							if (lengthSqr(d) < r2 && dot(ph.n, n) > 0.9f) {
+								f(ph);
+							}
+						}
+					}
+				}
+			}
+		}
+
+	private:
+		int cellCoord(float v) const {
+			return int(floorf(v / m_cellSize));
+		}
+
+		uint32_t cellHash(int x, int y, int z) const {
+			uint32_t h = uint32_t(x) * 73856093u ^ uint32_t(y) * 19349663u ^ uint32_t(z) * 83492791u;
+			return h & uint32_t(m_cellStart.size() - 2);
+		}
+
+		std::vector<Photon> m_photons;
+		std::vector<uint32_t> m_cellStart;
+		float m_cellSize;
+		size_t m_emitted;
+	};
+}
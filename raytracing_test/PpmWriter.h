@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "ExrWriter.h"
+#include "Image.h"
+
+namespace rayt {
+	// Binary PPM (P6) whose rows are addressed by offset, so 8-bit tiles can be
+	// streamed into place in any order without the whole image being resident.
+	class PpmWriter {
+	public:
+		PpmWriter() : m_fp(nullptr) { }
+		~PpmWriter() { close(); }
+
+		bool open(const std::string& path, int width, int height) {
+			close();
+#ifdef _MSC_VER
+			if (fopen_s(&m_fp, path.c_str(), "wb") != 0) m_fp = nullptr;
+#else
+			m_fp = fopen(path.c_str(), "wb");
+#endif
+			if (!m_fp) {
+				return false;
+			}
+			m_width = width;
+			m_height = height;
+			fprintf(m_fp, "P6\n%d %d\n255\n", width, height);
+			m_dataPos = file_tell(m_fp);
+			return true;
+		}
+
+		// tile points at the tile's top-left pixel; stride is the row pitch in pixels.
+		bool writeTile(int x0, int y0, int x1, int y1, const Image::rgb* tile, int stride) {
+			if (!m_fp) {
+				return false;
+			}
+			int tw = x1 - x0;
+			std::vector<unsigned char> bytes(size_t(tw) * 3);
+			for (int y = y0; y < y1; ++y) {
+				const Image::rgb* row = tile + size_t(y - y0) * stride;
+				for (int x = 0; x < tw; ++x) {
+					bytes[size_t(x) * 3 + 0] = row[x].r;
+					bytes[size_t(x) * 3 + 1] = row[x].g;
+					bytes[size_t(x) * 3 + 2] = row[x].b;
+				}
+				if (file_seek(m_fp, m_dataPos + (int64_t(y) * m_width + x0) * 3) != 0
+					|| fwrite(bytes.data(), 1, bytes.size(), m_fp) != bytes.size()) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		bool close() {
+			if (!m_fp) {
+				return false;
+			}
+			bool ok = fclose(m_fp) == 0;
+			m_fp = nullptr;
+			return ok;
+		}
+
+	private:
+		FILE* m_fp;
+		int m_width, m_height;
+		int64_t m_dataPos;
+	};
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+namespace rayt {
+	// First hits of camera rays, recorded by one render and replayed by later renders
+	// of the same geometry with the same camera, size, samples and first sample, such
+	// as the other wavelength passes or the points of a correlated sweep. An entry is
+	// the index of the top-level shape that was hit, which alone is then intersected
+	// again to rebuild the hit exactly. Only as many samples of each pixel as fit in
+	// the memory budget are kept; the rest are traced as usual.
+	class PrimaryHitCache {
+	public:
+		enum : uint16_t {
+			kUnknown = 0,   // Not recorded yet
+			kEscaped = 1,   // The ray hit nothing
+			kFirstShape = 2 // Top-level shape k is stored as kFirstShape + k
+		};
+
+		PrimaryHitCache(int width, int height, int samples, size_t budgetBytes)
+			: m_width(width)
+			, m_samples(int(std::min<size_t>(samples, budgetBytes / (sizeof(uint16_t) * width * height))))
+			, m_entries(size_t(width) * height * m_samples, kUnknown) { }
+
+		// Samples of each pixel that are cached.
+		int samples() const { return m_samples; }
+
+		// Entry of the s-th sample of pixel (i, j), null when it is not cached. Each
+		// entry may only be used by one thread at a time.
+		uint16_t* entry(int i, int j, int s) {
+			if (s >= m_samples) {
+				return nullptr;
+			}
+			return &m_entries[(size_t(j) * m_width + i) * m_samples + s];
+		}
+
+	private:
+		int m_width;
+		int m_samples;
+		std::vector<uint16_t> m_entries;
+	};
+}
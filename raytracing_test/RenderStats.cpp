@@ -0,0 +1,155 @@
+#include <mutex>
+#include <algorithm>
+#include <iomanip>
+#include <string>
+#include "RenderStats.h"
+
+using namespace rayt;
+
+namespace {
+	const char* SHAPE_NAMES[RenderStats::kShapeTypeCount] = { "sphere", "rect", "triangle" };
+	const char* MATERIAL_NAMES[RenderStats::kMaterialTypeCount] = { "lambertian", "metal", "dielectric", "diffuse light" };
+	const char* TERMINATION_NAMES[RenderStats::kTerminationCount] = { "escaped", "absorbed", "max depth" };
+	const int HISTOGRAM_WIDTH = 40;
+
+	std::mutex& registryMutex()
+	{
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	std::vector<RenderStats*>& registry()
+	{
+		static std::vector<RenderStats*> slots;
+		return slots;
+	}
+
+	// Counters of threads that have exited.
+	RenderStats& retired()
+	{
+		static RenderStats stats;
+		return stats;
+	}
+
+	double mega(uint64_t count, double seconds)
+	{
+		return seconds > 0 ? double(count) / seconds * 1e-6 : 0;
+	}
+}
+
+RenderStats::Slot::Slot()
+{
+	std::lock_guard<std::mutex> lock(registryMutex());
+	registry().push_back(this);
+}
+
+RenderStats::Slot::~Slot()
+{
+	std::lock_guard<std::mutex> lock(registryMutex());
+	auto& slots = registry();
+	slots.erase(std::remove(slots.begin(), slots.end(), this), slots.end());
+	retired().merge(*this);
+}
+
+RenderStats* RenderStats::registerThread()
+{
+	static thread_local Slot slot;
+	return &slot;
+}
+
+void RenderStats::clear()
+{
+	primaryRays = 0;
+	secondaryRays = 0;
+	std::fill(std::begin(intersectionTests), std::end(intersectionTests), uint64_t(0));
+	std::fill(std::begin(scatterCalls), std::end(scatterCalls), uint64_t(0));
+	std::fill(std::begin(terminations), std::end(terminations), uint64_t(0));
+	std::fill(std::begin(pathDepth), std::end(pathDepth), uint64_t(0));
+}
+
+void RenderStats::merge(const RenderStats& other)
+{
+	primaryRays += other.primaryRays;
+	secondaryRays += other.secondaryRays;
+	for (int i = 0; i < kShapeTypeCount; ++i) {
+		intersectionTests[i] += other.intersectionTests[i];
+	}
+	for (int i = 0; i < kMaterialTypeCount; ++i) {
+		scatterCalls[i] += other.scatterCalls[i];
+	}
+	for (int i = 0; i < kTerminationCount; ++i) {
+		terminations[i] += other.terminations[i];
+	}
+	for (int i = 0; i <= MAX_DEPTH; ++i) {
+		pathDepth[i] += other.pathDepth[i];
+	}
+}
+
+void RenderStats::clearAll()
+{
+	std::lock_guard<std::mutex> lock(registryMutex());
+	for (RenderStats* stats : registry()) {
+		stats->clear();
+	}
+	retired().clear();
+}
+
+RenderStats RenderStats::collect(std::vector<RenderStats>* perThread)
+{
+	std::lock_guard<std::mutex> lock(registryMutex());
+	RenderStats total = retired();
+	if (perThread) {
+		perThread->clear();
+	}
+	for (RenderStats* stats : registry()) {
+		total.merge(*stats);
+		if (perThread && stats->rays() > 0) {
+			perThread->push_back(*stats);
+		}
+	}
+	return total;
+}
+
+void RenderStats::report(std::ostream& os, double seconds) const
+{
+	os << "rays " << rays() << " (primary " << primaryRays << ", secondary " << secondaryRays << ") "
+		<< std::fixed << std::setprecision(2) << mega(rays(), seconds) << " Mrays/s" << std::defaultfloat << std::endl;
+
+	os << "intersection tests";
+	for (int i = 0; i < kShapeTypeCount; ++i) {
+		os << " " << SHAPE_NAMES[i] << " " << intersectionTests[i];
+	}
+	os << std::endl;
+
+	os << "scatter calls";
+	for (int i = 0; i < kMaterialTypeCount; ++i) {
+		os << " " << MATERIAL_NAMES[i] << " " << scatterCalls[i];
+	}
+	os << std::endl;
+
+	uint64_t paths = 0;
+	uint64_t bounces = 0;
+	uint64_t peak = 0;
+	for (int i = 0; i <= MAX_DEPTH; ++i) {
+		paths += pathDepth[i];
+		bounces += pathDepth[i] * i;
+		peak = std::max(peak, pathDepth[i]);
+	}
+	if (paths == 0) {
+		return;
+	}
+	os << "paths " << paths << ", mean depth " << double(bounces) / double(paths);
+	for (int i = 0; i < kTerminationCount; ++i) {
+		os << ", " << TERMINATION_NAMES[i] << " " << terminations[i];
+	}
+	os << std::endl;
+
+	int last = MAX_DEPTH;
+	while (last > 0 && pathDepth[last] == 0) {
+		--last;
+	}
+	for (int i = 0; i <= last; ++i) {
+		int bar = int(pathDepth[i] * HISTOGRAM_WIDTH / peak);
+		os << std::setw(4) << i << " " << std::setw(12) << pathDepth[i] << " " << std::string(bar, '#') << std::endl;
+	}
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "inline_math.h"
+
+namespace rayt {
+	// Set to false to compile every counter out.
+	constexpr bool COLLECT_STATS = true;
+
+	// Render counters. Every thread increments its own copy through local(), so
+	// nothing is shared while rendering; collect() sums them once the threads are idle.
+	struct RenderStats {
+		enum ShapeType {
+			kSphere = 0,
+			kRect,
+			kTriangle,
+			kShapeTypeCount
+		};
+		enum MaterialType {
+			kLambertian = 0,
+			kMetal,
+			kDielectric,
+			kDiffuseLight,
+			kMaterialTypeCount
+		};
+		enum Termination {
+			kEscaped = 0, // Left the scene
+			kAbsorbed,    // Hit a surface that does not scatter, e.g. a light
+			kMaxDepth,    // Cut off at MAX_DEPTH
+			kTerminationCount
+		};
+
+		uint64_t primaryRays;
+		uint64_t secondaryRays;
+		uint64_t intersectionTests[kShapeTypeCount];
+		uint64_t scatterCalls[kMaterialTypeCount];
+		uint64_t terminations[kTerminationCount];
+		uint64_t pathDepth[MAX_DEPTH + 1]; // Camera paths by bounce count
+
+		RenderStats() { clear(); }
+
+		void clear();
+		void merge(const RenderStats& other);
+		uint64_t rays() const { return primaryRays + secondaryRays; }
+		// seconds is the wall time the counted work took.
+		void report(std::ostream& os, double seconds) const;
+
+		// Counters of the calling thread.
+		static RenderStats& local();
+		// Clears the counters of every thread.
+		static void clearAll();
+		// Sums the counters of every thread, optionally keeping each thread's share.
+		static RenderStats collect(std::vector<RenderStats>* perThread = nullptr);
+
+		static void countRay(bool primary) {
+			if (COLLECT_STATS) {
+				RenderStats& s = local();
+				++(primary ? s.primaryRays : s.secondaryRays);
+			}
+		}
+		static void countIntersection(ShapeType type) {
+			if (COLLECT_STATS) {
+				++local().intersectionTests[type];
+			}
+		}
+		static void countScatter(MaterialType type) {
+			if (COLLECT_STATS) {
+				++local().scatterCalls[type];
+			}
+		}
+		static void countPath(int depth, Termination reason) {
+			if (COLLECT_STATS) {
+				RenderStats& s = local();
+				++s.pathDepth[depth < MAX_DEPTH ? depth : MAX_DEPTH];
+				++s.terminations[reason];
+			}
+		}
+
+	private:
+		struct Slot;
+		static RenderStats* registerThread();
+	};
+
+	// A thread's counters, registered for collect() while the thread lives.
+	struct RenderStats::Slot : RenderStats {
+		Slot();
+		~Slot();
+	};
+
+	inline RenderStats& RenderStats::local()
+	{
+		// A plain pointer needs no per-access initialization guard, unlike the Slot itself.
+		static thread_local RenderStats* stats = nullptr;
+		if (!stats) {
+			stats = registerThread();
+		}
+		return *stats;
+	}
+}
@@ -0,0 +1,282 @@
+#include <omp.h>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cfloat>
+#include "SPPM.h"
+#include "Scene.h"
+#include "Camera.h"
+#include "Shape.h"
+#include "PhotonMap.h"
+
+using namespace rayt;
+
+struct SPPM::VisiblePoint {
+	HitRec hrec;
+	vec3 wo;
+	vec3 beta;
+	bool valid;
+};
+
+SPPM::SPPM(const Scene& scene, int totalPasses, size_t photonsPerPass, float initialRadius, float alpha)
+	: m_scene(scene)
+	, m_photonsPerPass(photonsPerPass)
+	, m_alpha(alpha)
+	, m_totalPasses(totalPasses)
+	, m_passes(0)
+	, m_stats(size_t(scene.width()) * scene.height()) {
+	for (auto& st : m_stats) {
+		st = { { 0, 0, 0 }, { 0, 0, 0 }, initialRadius, 0 };
+	}
+}
+
+SPPM::~SPPM() = default;
+
+void SPPM::run(int passes)
+{
+	std::vector<VisiblePoint> points(m_stats.size());
+	for (; m_passes < passes; ++m_passes) {
+		cameraPass(points);
+
+		float maxRadius = 0;
+		for (size_t i = 0; i < m_stats.size(); ++i) {
+			if (points[i].valid) {
+				maxRadius = std::max(maxRadius, m_stats[i].radius);
+			}
+		}
+		if (maxRadius > 0) {
+			photonPass(points, maxRadius);
+		}
+	}
+}
+
+void SPPM::cameraPass(std::vector<VisiblePoint>& points)
+{
+	const int nx = m_scene.width();
+	const int ny = m_scene.height();
+	const Shape* world = m_scene.world();
+
+#pragma omp parallel
+	{
+		SamplerPtr sampler = createSampler(m_scene.samplerType(), nx, ny, m_totalPasses);
+
+#pragma omp for schedule(dynamic)
+		for (int y = 0; y < ny; ++y) {
+			const int j = ny - y - 1;
+			for (int i = 0; i < nx; ++i) {
+				VisiblePoint& vp = points[size_t(y) * nx + i];
+				PixelStats& st = m_stats[size_t(y) * nx + i];
+				vp.valid = false;
+
+				float du, dv;
+				sampler->start(i, j, m_passes);
+				sampler->get2D(du, dv);
+				Ray r = m_scene.camera().getRay((float(i) + du) / float(nx), (float(j) + dv) / float(ny));
+
+				vec3 beta(1);
+				vec3 ld(0);
+				for (int depth = 0; depth < MAX_DEPTH; ++depth) {
+					HitRec hrec;
+					RenderStats::countRay(depth == 0);
+					if (!world->hit(r, 0.001, FLT_MAX, hrec)) {
+						ld += mulPerElem(beta, m_scene.backColor());
+						break;
+					}
+					ld += mulPerElem(beta, hrec.mat->emitted(r, hrec));
+					if (!hrec.mat->isSpecular()) {
+						vp.hrec = hrec;
+						vp.wo = -normalize(r.direction());
+						vp.beta = beta;
+						vp.valid = true;
+						break;
+					}
+					ScatterRec srec;
+					if (!hrec.mat->scatter(r, hrec, srec, *sampler)) {
+						break;
+					}
+					beta = mulPerElem(beta, srec.albedo);
+					r = srec.ray;
+				}
+				st.ld[0] += ld.getX();
+				st.ld[1] += ld.getY();
+				st.ld[2] += ld.getZ();
+			}
+		}
+	}
+}
+
+void SPPM::photonPass(const std::vector<VisiblePoint>& points, float maxRadius)
+{
+	const Shape* world = m_scene.world();
+	std::vector<TaggedPhotons> stored;
+
+#pragma omp parallel
+	{
+#pragma omp single
+		stored.resize(omp_get_num_threads());
+
+		TaggedPhotons& photons = stored[omp_get_thread_num()];
+		SamplerPtr sampler = createSampler(m_scene.samplerType() == kRandomSampler ? kRandomSampler : kSobolSampler,
+			m_scene.width(), m_scene.height(), 1);
+
+#pragma omp for schedule(dynamic, 1024)
+		for (long long k = 0; k < (long long)m_photonsPerPass; ++k) {
+			// Photon indices pass 2^32 in long renders; the high bits select another sequence.
+			const uint64_t index = uint64_t(m_passes) * m_photonsPerPass + uint64_t(k);
+			sampler->start(-1 - int(index >> 32), -1, int(uint32_t(index)));
+			Ray r;
+			vec3 power;
+			if (!m_scene.samplePhoton(*sampler, r, power)) {
+				continue;
+			}
+			power /= float(m_photonsPerPass);
+
+			for (int depth = 0; depth < MAX_DEPTH; ++depth) {
+				HitRec hrec;
+				RenderStats::countRay(false);
+				if (!world->hit(r, 0.001, FLT_MAX, hrec)) {
+					break;
+				}
+				if (!hrec.mat->isSpecular()) {
+					photons.push_back({ k, { hrec.p, hrec.n, normalize(r.direction()), power } });
+				}
+				ScatterRec srec;
+				if (!hrec.mat->scatter(r, hrec, srec, *sampler)) {
+					break;
+				}
+				power = mulPerElem(power, srec.albedo);
+				r = srec.ray;
+			}
+		}
+	}
+
+	PhotonMap map;
+	map.build(merge_photons(stored), maxRadius, m_photonsPerPass);
+
+	const long long pixelCount = (long long)points.size();
+#pragma omp parallel for schedule(dynamic, 256)
+	for (long long i = 0; i < pixelCount; ++i) {
+		const VisiblePoint& vp = points[i];
+		if (!vp.valid) {
+			continue;
+		}
+		PixelStats& st = m_stats[i];
+		vec3 phi(0);
+		int m = 0;
+		map.gather(vp.hrec.p, vp.hrec.n, st.radius, [&](const Photon& ph) {
+			phi += mulPerElem(vp.hrec.mat->eval(vp.hrec, vp.wo, -ph.dir), ph.power);
+			++m;
+		});
+		if (m == 0) {
+			continue;
+		}
+		float n = st.n + m_alpha * m;
+		float radius = st.radius * sqrtf(n / (st.n + m));
+		float shrink = pow2(radius / st.radius);
+		phi = mulPerElem(vp.beta, phi);
+		st.tau[0] = (st.tau[0] + phi.getX()) * shrink;
+		st.tau[1] = (st.tau[1] + phi.getY()) * shrink;
+		st.tau[2] = (st.tau[2] + phi.getZ()) * shrink;
+		st.n = n;
+		st.radius = radius;
+	}
+}
+
+void SPPM::resolve(Vector3 image[]) const
+{
+	const float passes = float(std::max(m_passes, 1));
+	const long long pixelCount = (long long)m_stats.size();
+#pragma omp parallel for
+	for (long long i = 0; i < pixelCount; ++i) {
+		const PixelStats& st = m_stats[i];
+		float k = 1.f / (passes * PI * pow2(st.radius));
+		image[i] = vec3(st.ld[0], st.ld[1], st.ld[2]) / passes + vec3(st.tau[0], st.tau[1], st.tau[2]) * k;
+	}
+}
+
+namespace {
+	// A checkpoint only resumes the render it was written by.
+	struct CheckpointHeader {
+		char magic[4];
+		int32_t width;
+		int32_t height;
+		int32_t passes;
+		int32_t totalPasses;
+		int32_t sampler;
+		int32_t sceneType;
+		float rgb[3];
+		float ior;
+		uint64_t photonsPerPass;
+	};
+
+	const char CHECKPOINT_MAGIC[4] = { 'S', 'P', 'P', '2' };
+
+	CheckpointHeader checkpointHeader(const Scene& scene, int passes, int totalPasses, size_t photonsPerPass)
+	{
+		CheckpointHeader header;
+		memset(&header, 0, sizeof(header)); // Padding is written too
+		memcpy(header.magic, CHECKPOINT_MAGIC, 4);
+		header.width = scene.width();
+		header.height = scene.height();
+		header.passes = passes;
+		header.totalPasses = totalPasses;
+		header.sampler = scene.samplerType();
+		header.sceneType = scene.sceneType();
+		header.rgb[0] = scene.lightParam().getX();
+		header.rgb[1] = scene.lightParam().getY();
+		header.rgb[2] = scene.lightParam().getZ();
+		header.ior = scene.refractiveParam();
+		header.photonsPerPass = photonsPerPass;
+		return header;
+	}
+}
+
+bool SPPM::saveCheckpoint(const std::string& path) const
+{
+	FILE* fp = nullptr;
+#ifdef _MSC_VER
+	if (fopen_s(&fp, path.c_str(), "wb") != 0) fp = nullptr;
+#else
+	fp = fopen(path.c_str(), "wb");
+#endif
+	if (!fp) {
+		return false;
+	}
+	CheckpointHeader header = checkpointHeader(m_scene, m_passes, m_totalPasses, m_photonsPerPass);
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+		&& fwrite(m_stats.data(), sizeof(PixelStats), m_stats.size(), fp) == m_stats.size();
+	return fclose(fp) == 0 && ok;
+}
+
+bool SPPM::loadCheckpoint(const std::string& path)
+{
+	FILE* fp = nullptr;
+#ifdef _MSC_VER
+	if (fopen_s(&fp, path.c_str(), "rb") != 0) fp = nullptr;
+#else
+	fp = fopen(path.c_str(), "rb");
+#endif
+	if (!fp) {
+		return false;
+	}
+	CheckpointHeader header;
+	const CheckpointHeader expected = checkpointHeader(m_scene, 0, m_totalPasses, m_photonsPerPass);
+	bool ok = fread(&header, sizeof(header), 1, fp) == 1
+		&& memcmp(header.magic, expected.magic, 4) == 0
+		&& header.width == expected.width
+		&& header.height == expected.height
+		&& header.totalPasses == expected.totalPasses
+		&& header.sampler == expected.sampler
+		&& header.sceneType == expected.sceneType
+		&& memcmp(header.rgb, expected.rgb, sizeof(header.rgb)) == 0
+		&& header.ior == expected.ior
+		&& header.photonsPerPass == expected.photonsPerPass;
+	std::vector<PixelStats> stats(m_stats.size());
+	ok = ok && fread(stats.data(), sizeof(PixelStats), stats.size(), fp) == stats.size();
+	fclose(fp);
+	if (ok) {
+		m_stats.swap(stats);
+		m_passes = header.passes;
+	}
+	return ok;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include "inline_math.h"
+
+namespace rayt {
+	class Scene;
+	class HitRec;
+
+	// Stochastic progressive photon mapping (Hachisuka & Jensen 2009).
+	// Each pass traces one camera sample per pixel to its first diffuse hit, then a
+	// fresh batch of photons that is gathered at those points and discarded, so
+	// memory does not grow with the total photon count. Gather radii shrink per
+	// pixel and the estimate converges, caustics included.
+	class SPPM {
+	public:
+		// totalPasses is the pass count of the whole render, over which camera samples are laid out.
+		SPPM(const Scene& scene, int totalPasses, size_t photonsPerPass, float initialRadius, float alpha = 0.7f);
+		~SPPM();
+
+		// Runs passes until `passes` have been completed in total.
+		void run(int passes);
+		void resolve(Vector3 image[]) const;
+		int passes() const { return m_passes; }
+
+		// Per-pixel statistics, so a long render can be resumed. A checkpoint is only
+		// loaded into the same render: size, scene, light, IOR, sampler and pass counts.
+		bool saveCheckpoint(const std::string& path) const;
+		bool loadCheckpoint(const std::string& path);
+
+	private:
+		struct PixelStats {
+			float ld[3];  // Emission seen directly by camera paths
+			float tau[3]; // Accumulated, radius-corrected photon flux
+			float radius;
+			float n;      // Photon count in the shrinking-radius sense
+		};
+		struct VisiblePoint;
+
+		void cameraPass(std::vector<VisiblePoint>& points);
+		void photonPass(const std::vector<VisiblePoint>& points, float maxRadius);
+
+		const Scene& m_scene;
+		size_t m_photonsPerPass;
+		float m_alpha;
+		int m_totalPasses;
+		int m_passes;
+		std::vector<PixelStats> m_stats;
+	};
+}
@@ -0,0 +1,320 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <algorithm>
+#include "inline_math.h"
+
+namespace rayt {
+	inline uint32_t hash_u32(uint32_t x) {
+		x ^= x >> 16;
+		x *= 0x7feb352du;
+		x ^= x >> 15;
+		x *= 0x846ca68bu;
+		x ^= x >> 16;
+		return x;
+	}
+
+	inline uint32_t hash_combine(uint32_t seed, uint32_t v) {
+		return seed ^ (hash_u32(v) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+	}
+
+	inline float u32_to_float(uint32_t x) {
+		return float(x >> 8) * (1.f / 16777216.f); // [0, 1)
+	}
+
+	inline uint32_t reverse_bits(uint32_t x) {
+		x = (x << 16) | (x >> 16);
+		x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+		x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+		x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+		x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+		return x;
+	}
+
+	// Burley, "Practical Hash-based Owen Scrambling", JCGT 2020.
+	inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+		x += seed;
+		x ^= x * 0x6c50b47cu;
+		x ^= x * 0xb82f1e52u;
+		x ^= x * 0xc7afe638u;
+		x ^= x * 0x8d22f6e6u;
+		return x;
+	}
+
+	inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+		return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+	}
+
+	// First two dimensions of the Sobol sequence as 32-bit fixed point.
+	inline uint32_t sobol(uint32_t index, int dim) {
+		uint32_t x = 0;
+		uint32_t v = 0x80000000u;
+		for (; index; index >>= 1) {
+			if (index & 1) x ^= v;
+			v = dim == 0 ? v >> 1 : v ^ (v >> 1);
+		}
+		return x;
+	}
+
+	// Kensler, "Correlated Multi-Jittered Sampling", Pixar TM 2013.
+	inline uint32_t permute(uint32_t i, uint32_t l, uint32_t p) {
+		uint32_t w = l - 1;
+		w |= w >> 1;
+		w |= w >> 2;
+		w |= w >> 4;
+		w |= w >> 8;
+		w |= w >> 16;
+		do {
+			i ^= p; i *= 0xe170893du;
+			i ^= p >> 16;
+			i ^= (i & w) >> 4;
+			i ^= p >> 8; i *= 0x0929eb3fu;
+			i ^= p >> 23;
+			i ^= (i & w) >> 1; i *= 1 | p >> 27;
+			i *= 0x6935fa69u;
+			i ^= (i & w) >> 11; i *= 0x74dcb303u;
+			i ^= (i & w) >> 2; i *= 0x9e501cc3u;
+			i ^= (i & w) >> 2; i *= 0xc860a3dfu;
+			i &= w;
+			i ^= i >> 5;
+		} while (i >= l);
+		return (i + p) % l;
+	}
+
+	//--------------------------------------------------------------------------------
+
+	// Supplies the random numbers of one pixel sample. Every get1D/get2D call
+	// consumes the next dimension of the sample, so a path draws the camera jitter
+	// first and then the numbers for each bounce in order. Every number is a pure
+	// function of (pixel, sample index, dimension), never of the calling thread.
+	class Sampler {
+	public:
+		// Dimensions reserved for each bounce; see startBounce().
+		static constexpr uint32_t DIMENSIONS_PER_BOUNCE = 8;
+
+		Sampler() : m_dim(0) {}
+		virtual ~Sampler() {}
+		virtual void start(int x, int y, int index) = 0;
+		virtual float get1D() = 0;
+		virtual void get2D(float& u1, float& u2) = 0;
+
+		// Jumps to the dimensions of the given bounce, so the numbers of a bounce
+		// do not shift with how many the bounces before it consumed.
+		void startBounce(int bounce) { m_dim = DIMENSIONS_PER_BOUNCE * uint32_t(bounce + 1); }
+
+	protected:
+		uint32_t m_dim;
+	};
+	typedef std::unique_ptr<Sampler> SamplerPtr;
+
+	enum SamplerType {
+		kRandomSampler = 0,
+		kStratifiedSampler,
+		kSobolSampler,
+		kBlueNoiseSampler
+	};
+
+	//--------------------------------------------------------------------------------
+
+	// Independent uniform numbers from a counter-based hash of (pixel, sample
+	// index, dimension).
+	class RandomSampler : public Sampler {
+	public:
+		virtual void start(int x, int y, int index) override {
+			m_key = hash_combine(hash_combine(hash_u32(uint32_t(x)), uint32_t(y)), uint32_t(index));
+			m_dim = 0;
+		}
+		virtual float get1D() override {
+			return u32_to_float(hash_u32(hash_combine(m_key, m_dim++)));
+		}
+		virtual void get2D(float& u1, float& u2) override {
+			uint32_t h = hash_combine(m_key, m_dim++);
+			u1 = u32_to_float(hash_u32(h));
+			u2 = u32_to_float(hash_u32(h ^ 0x5bd1e995u));
+		}
+
+	private:
+		uint32_t m_key;
+	};
+
+	//--------------------------------------------------------------------------------
+
+	// Correlated multi-jittered samples: each dimension (pair) of a pixel is
+	// stratified over the pixel's sample count, with an independent permutation.
+	// The 2D strata are the m x n grid with m * n equal to the sample count and m
+	// the largest such factor up to its square root; prime counts get 1 x n, which
+	// is still stratified along both axes. Indices past the sample count start another epoch with its own permutation
+	// and jitter, so disjoint index ranges draw independent samples.
+	class StratifiedSampler : public Sampler {
+	public:
+		StratifiedSampler(int samples)
+			: m_samples(samples) {
+			m_m = 1;
+			for (uint32_t m = 2; m * m <= uint32_t(samples); ++m) {
+				if (uint32_t(samples) % m == 0) m_m = m;
+			}
+			m_n = uint32_t(samples) / m_m;
+		}
+
+		virtual void start(int x, int y, int index) override {
+			m_pixel = hash_combine(hash_u32(uint32_t(x)), uint32_t(y));
+			m_index = uint32_t(index);
+			m_dim = 0;
+		}
+
+		virtual float get1D() override {
+			uint32_t p = hash_combine(m_pixel, m_dim++) ^ hash_u32(m_index / m_samples);
+			uint32_t s = permute(m_index % m_samples, m_samples, p * 0x68bc21ebu);
+			float j = u32_to_float(hash_combine(p, m_index));
+			return (float(s) + j) / float(m_samples);
+		}
+
+		virtual void get2D(float& u1, float& u2) override {
+			uint32_t p = hash_combine(m_pixel, m_dim++) ^ hash_u32(m_index / m_samples);
+			uint32_t s = permute(m_index % m_samples, m_samples, p * 0x51633e2du);
+			uint32_t sx = permute(s % m_m, m_m, p * 0xa511e9b3u);
+			uint32_t sy = permute(s / m_m, m_n, p * 0x63d83595u);
+			float jx = u32_to_float(hash_combine(p * 0xa399d265u, s));
+			float jy = u32_to_float(hash_combine(p * 0x711ad6a5u, s));
+			u1 = (float(s % m_m) + (float(sy) + jx) / float(m_n)) / float(m_m);
+			u2 = (float(s / m_m) + (float(sx) + jy) / float(m_m)) / float(m_n);
+		}
+
+	private:
+		uint32_t m_samples;
+		uint32_t m_m, m_n;
+		uint32_t m_pixel;
+		uint32_t m_index;
+	};
+
+	//--------------------------------------------------------------------------------
+
+	// Owen-scrambled, shuffled Sobol (0,2)-sequence per pixel. Higher dimensions
+	// are padded by giving each dimension pair its own scramble and shuffle seed.
+	class SobolSampler : public Sampler {
+	public:
+		virtual void start(int x, int y, int index) override {
+			m_pixel = hash_combine(hash_u32(uint32_t(x)), uint32_t(y));
+			m_index = uint32_t(index);
+			m_dim = 0;
+		}
+
+		virtual float get1D() override {
+			uint32_t seed = hash_combine(m_pixel, m_dim++);
+			uint32_t i = nested_uniform_scramble(m_index, seed);
+			return u32_to_float(nested_uniform_scramble(sobol(i, 0), hash_combine(seed, 0)));
+		}
+
+		virtual void get2D(float& u1, float& u2) override {
+			uint32_t seed = hash_combine(m_pixel, m_dim++);
+			uint32_t i = nested_uniform_scramble(m_index, seed);
+			u1 = u32_to_float(nested_uniform_scramble(sobol(i, 0), hash_combine(seed, 0)));
+			u2 = u32_to_float(nested_uniform_scramble(sobol(i, 1), hash_combine(seed, 1)));
+		}
+
+	private:
+		uint32_t m_pixel;
+		uint32_t m_index;
+	};
+
+	//--------------------------------------------------------------------------------
+
+	// Screen-space blue-noise error distribution in the manner of Ahmed & Wonka's
+	// z-sampler: all pixels share one Owen-scrambled Sobol sequence, and each pixel
+	// takes a consecutive power-of-two block of it in (scrambled) Morton order, so
+	// neighbouring pixels receive complementary, well-stratified samples. Each
+	// dimension pair uses its own Morton and in-block scramble to stay decorrelated.
+	// Index bits above the block size select another scramble of the sequence, so
+	// disjoint index ranges draw independent samples. Pixel and sample bits share
+	// one 32-bit sequence index; see fits().
+	class BlueNoiseSampler : public Sampler {
+	public:
+		BlueNoiseSampler(int width, int height, int samples) {
+			m_sampleBits = sampleBits(samples);
+			m_mortonBits = mortonBits(width, height);
+			assert(m_mortonBits + m_sampleBits <= 32);
+		}
+
+		// Whether an image and sample count fit the 32-bit sequence index, e.g. up
+		// to 4096 x 4096 at 256 spp.
+		static bool fits(int width, int height, int samples) {
+			return mortonBits(width, height) + sampleBits(samples) <= 32;
+		}
+
+		virtual void start(int x, int y, int index) override {
+			m_morton = morton(uint32_t(x), uint32_t(y));
+			m_index = uint32_t(index);
+			m_dim = 0;
+		}
+
+		virtual float get1D() override {
+			uint32_t seed = hash_u32(m_dim++) ^ hash_u32(m_index >> m_sampleBits);
+			uint32_t i = sequenceIndex(seed);
+			return u32_to_float(nested_uniform_scramble(sobol(i, 0), hash_combine(seed, 0)));
+		}
+
+		virtual void get2D(float& u1, float& u2) override {
+			uint32_t seed = hash_u32(m_dim++) ^ hash_u32(m_index >> m_sampleBits);
+			uint32_t i = sequenceIndex(seed);
+			u1 = u32_to_float(nested_uniform_scramble(sobol(i, 0), hash_combine(seed, 0)));
+			u2 = u32_to_float(nested_uniform_scramble(sobol(i, 1), hash_combine(seed, 1)));
+		}
+
+	private:
+		static uint32_t sampleBits(int samples) {
+			uint32_t bits = 0;
+			while ((1u << bits) < uint32_t(samples)) ++bits;
+			return bits;
+		}
+
+		static uint32_t mortonBits(int width, int height) {
+			uint32_t bits = 0;
+			while ((1u << bits) < uint32_t(std::max(width, height))) ++bits;
+			return 2 * bits;
+		}
+
+		static uint32_t morton(uint32_t x, uint32_t y) {
+			uint32_t m = 0;
+			for (int b = 0; b < 16; ++b) {
+				m |= ((x >> b) & 1u) << (2 * b);
+				m |= ((y >> b) & 1u) << (2 * b + 1);
+			}
+			return m;
+		}
+
+		// Owen scramble of the low `bits` bits of x, a permutation of [0, 2^bits).
+		static uint32_t scrambleBits(uint32_t x, uint32_t bits, uint32_t seed) {
+			if (bits == 0) return 0;
+			uint32_t shift = 32 - bits;
+			return nested_uniform_scramble(x << shift, seed) >> shift;
+		}
+
+		uint32_t sequenceIndex(uint32_t seed) const {
+			uint32_t m = scrambleBits(m_morton, m_mortonBits, hash_combine(seed, 2));
+			uint32_t s = scrambleBits(m_index, m_sampleBits, hash_combine(seed, 3));
+			return (m << m_sampleBits) | s;
+		}
+
+		uint32_t m_sampleBits;
+		uint32_t m_mortonBits;
+		uint32_t m_morton;
+		uint32_t m_index;
+	};
+
+	//--------------------------------------------------------------------------------
+
+	inline SamplerPtr createSampler(SamplerType type, int width, int height, int samples) {
+		switch (type) {
+		case kStratifiedSampler: return std::make_unique<StratifiedSampler>(samples);
+		case kSobolSampler: return std::make_unique<SobolSampler>();
+		case kBlueNoiseSampler:
+			// Too many pixels and samples for its index fall back to plain per-pixel Sobol.
+			if (BlueNoiseSampler::fits(width, height, samples)) {
+				return std::make_unique<BlueNoiseSampler>(width, height, samples);
+			}
+			return std::make_unique<SobolSampler>();
+		default: return std::make_unique<RandomSampler>();
+		}
+	}
+}
@@ -1,35 +1,74 @@
+#include <omp.h>
 #include "Scene.h"
-#include "Image.h"
 #include "Camera.h"
 #include "Shape.h"
+#include "PhotonMap.h"
+#include "BDPT.h"
+#include "PathGuide.h"
+#include "PrimaryHitCache.h"
+#include "Trace.h"
 
 using namespace rayt;
 
-Scene::Scene(int width, int height, int samples)
-	: m_image(make_unique<Image>(width, height))
+namespace {
+	const vec3 DEFAULT_LOOKFROM(278, 278, -800);
+	const vec3 DEFAULT_LOOKAT(278, 278, 0);
+	const float DEFAULT_VFOV = 40;
+}
+
+Scene::Scene(int width, int height, int samples, SamplerType samplerType)
+	: m_photonMap(nullptr)
+	, m_guide(nullptr)
+	, m_primaryHits(nullptr)
+	, m_aux(nullptr)
+	, m_integrator(kPathTracing)
+	, m_sceneType(kCornellPrism)
 	, m_backColor(0.2f)
-	, m_samples(samples) { }
+	, m_lightParam(0)
+	, m_refractiveParam(0)
+	, m_width(width)
+	, m_height(height)
+	, m_samples(samples)
+	, m_firstSample(0)
+	, m_samplerType(samplerType) { }
+
+Scene::Scene(const Scene& built, int width, int height, int samples, SamplerType samplerType)
+	: Scene(width, height, samples, samplerType) {
+	m_world = built.m_world;
+	m_lights = built.m_lights;
+	m_materials = built.m_materials;
+	m_lightMaterial = built.m_lightMaterial;
+	m_glass = built.m_glass;
+	m_sceneType = built.m_sceneType;
+	m_backColor = built.m_backColor;
+	m_lightParam = built.m_lightParam;
+	m_refractiveParam = built.m_refractiveParam;
+	m_boundsMin = built.m_boundsMin;
+	m_boundsMax = built.m_boundsMax;
+	setCamera(DEFAULT_LOOKFROM, DEFAULT_LOOKAT, DEFAULT_VFOV);
+	m_bdpt = make_unique<BDPT>(*this, MAX_DEPTH);
+}
 
 Scene::~Scene() = default;
 
 void Scene::build(float r_param, float g_param, float b_param, float refractive_param)
 {
+	TraceScope trace("build scene");
 	m_backColor = vec3(0);
+	m_lightParam = vec3(r_param, g_param, b_param);
+	m_refractiveParam = refractive_param;
+	m_boundsMin = vec3(0);
+	m_boundsMax = vec3(555);
 
 	// Camera
 
-	vec3 lookfrom(278, 278, -800);
-	vec3 lookat(278, 278, 0);
-	vec3 vup(0, 1, 0);
+	setCamera(DEFAULT_LOOKFROM, DEFAULT_LOOKAT, DEFAULT_VFOV);
 
 	// Zoom
 //           vec3 lookfrom( 180, 18, 60);
 //           vec3 lookat(180, 18, 80);
 //           vec3 vup(0, 1, 0);
 
-	float aspect = float(m_image->width()) / float(m_image->height());
-	m_camera = make_unique<Camera>(lookfrom, lookat, vup, 40, aspect);
-
 	// Shapes
 	MaterialPtr red = make_shared<Lambertian>(
 		make_shared<ColorTexture>(vec3(0.65f, 0.05f, 0.05f)));
@@ -37,8 +76,12 @@ void Scene::build(float r_param, float g_param, float b_param, float refractive_
 		make_shared<ColorTexture>(vec3(0.73f, 0.73f, 0.73f)));
 	MaterialPtr blue = make_shared<Lambertian>(
 		make_shared<ColorTexture>(vec3(0.12f, 0.15f, 0.45f)));
-	MaterialPtr light = make_shared<DiffuseLight>(
+	m_lightMaterial = make_shared<DiffuseLight>(
 		make_shared<ColorTexture>(vec3(15.0f * r_param, 15.0f * g_param, 15.0f * b_param)));
+	m_glass = make_shared<Dielectric>(refractive_param);
+	MaterialPtr light = m_lightMaterial;
+	MaterialPtr glass = m_glass;
+	m_materials = { red, white, blue, light, glass };
 
 
 	ShapeList* world = new ShapeList();
@@ -47,9 +90,11 @@ void Scene::build(float r_param, float g_param, float b_param, float refractive_
 			0, 555, 0, 555, 555, Rect::kYZ, blue)));
 	world->add(make_shared<Rect>(
 		0, 555, 0, 555, 0, Rect::kYZ, red));
-	world->add(make_shared<FlipNormals>(
+	ShapePtr lightShape = make_shared<FlipNormals>(
 		make_shared<Rect>(
-			213, 343, 227, 332, 554, Rect::kXZ, light)));
+			213, 343, 227, 332, 554, Rect::kXZ, light));
+	world->add(lightShape);
+	m_lights.assign(1, lightShape);
 	world->add(make_shared<FlipNormals>(
 		make_shared<Rect>(
 			0, 555, 0, 555, 555, Rect::kXZ, white)));
@@ -63,8 +108,27 @@ void Scene::build(float r_param, float g_param, float b_param, float refractive_
 		40, 0, 380, 330, Triangle::kXY, red));
 	*/
 
-	world->add(make_shared<Prism>(
-		vec3(70, 0, 130), 280, 50, make_shared<Dielectric>(refractive_param)/*red*/));
+	if (m_sceneType == kCornellSpheres) {
+		const MaterialPtr palette[4] = { white, glass, red, blue };
+		for (int z = 0; z < 10; ++z) {
+			for (int x = 0; x < 10; ++x) {
+				world->add(make_shared<Sphere>(
+					vec3(50.f + 50.f * x, 22, 50.f + 50.f * z), 22, palette[(x + z) % 4]));
+			}
+		}
+	}
+	else if (m_sceneType == kCornellMesh) {
+		for (int z = 0; z < 8; ++z) {
+			for (int x = 0; x < 8; ++x) {
+				world->add(make_shared<Prism>(
+					vec3(40.f + 60.f * x, 0, 40.f + 60.f * z), 40, 40, (x + z) % 2 ? glass : white));
+			}
+		}
+	}
+	else {
+		world->add(make_shared<Prism>(
+			vec3(70, 0, 130), 280, 50, glass/*red*/));
+	}
 
 	/*world->add(make_shared<Sphere>(
 			vec3(200, 125, 200), 125,
@@ -79,43 +143,290 @@ void Scene::build(float r_param, float g_param, float b_param, float refractive_
 					//world->add(make_shared<Box>(vec3(130, 0, 65), vec3(295, 165, 230), make_shared<Dielectric>(2.01f)));
 
 	m_world.reset(world);
+	m_bdpt = make_unique<BDPT>(*this, MAX_DEPTH);
+}
+
+void Scene::setParameters(float r_param, float g_param, float b_param, float refractive_param)
+{
+	m_lightMaterial->setEmission(make_shared<ColorTexture>(vec3(15.0f * r_param, 15.0f * g_param, 15.0f * b_param)));
+	m_glass->setRefractiveIndex(refractive_param);
+	m_lightParam = vec3(r_param, g_param, b_param);
+	m_refractiveParam = refractive_param;
+}
+
+const Shape* Scene::world() const
+{
+	return m_world.get();
+}
+
+void Scene::setCamera(const vec3& lookfrom, const vec3& lookat, float vfov)
+{
+	float aspect = float(m_width) / float(m_height);
+	m_camera = make_unique<Camera>(lookfrom, lookat, vec3(0, 1, 0), vfov, aspect);
 }
 
-vec3 Scene::color(const rayt::Ray& r, const Shape* world, int depth) const {
+vec3 Scene::color(const rayt::Ray& r, const Shape* world, int depth, Sampler& sampler, PathState state, FirstHit* first, uint16_t* cached) const {
 	HitRec hrec;
-	if (world->hit(r, 0.001, FLT_MAX, hrec)) {
-		vec3 emitted = hrec.mat->emitted(r, hrec);
+	if (!cached) {
+		RenderStats::countRay(depth == 0);
+	}
+	sampler.startBounce(depth);
+	if (cached ? hitPrimary(r, hrec, *cached) : world->hit(r, 0.001, FLT_MAX, hrec)) {
+		if (first) {
+			first->albedo = hrec.mat->albedo(hrec);
+			first->normal = hrec.n;
+			first->depth = hrec.t * length(r.direction());
+			first->t = hrec.t;
+			first->material = materialIndex(hrec.mat.get());
+		}
+		// L S+ D paths are already accounted for by the caustic photon map
+		vec3 emitted = state == kCausticPath ? vec3(0) : hrec.mat->emitted(r, hrec);
+		if (m_photonMap && !hrec.mat->isSpecular()) {
+			emitted += m_photonMap->estimate(hrec, -normalize(r.direction()), m_photonMap->radius());
+		}
 		ScatterRec srec;
-		if (depth < MAX_DEPTH && hrec.mat->scatter(r, hrec, srec)) {
-			return emitted + mulPerElem(srec.albedo, color(srec.ray, world, depth + 1));
+		float pdf;
+		if (depth < MAX_DEPTH && scatter(r, hrec, srec, sampler, pdf)) {
+			PathState next = state;
+			if (m_photonMap) {
+				next = !hrec.mat->isSpecular() ? kDiffusePath : state == kCameraPath ? kCameraPath : kCausticPath;
+			}
+			vec3 incoming = color(srec.ray, world, depth + 1, sampler, next);
+			if (pdf > 0 && m_guide->training()) {
+				float radiance = (incoming.getX() + incoming.getY() + incoming.getZ()) / 3.f;
+				m_guide->record(hrec.p, normalize(srec.ray.direction()), radiance / pdf);
+			}
+			return emitted + mulPerElem(srec.albedo, incoming);
 		}
 		else {
+			RenderStats::countPath(depth, depth < MAX_DEPTH ? RenderStats::kAbsorbed : RenderStats::kMaxDepth);
 			return emitted;
 		}
 	}
+	RenderStats::countPath(depth, RenderStats::kEscaped);
 	return this->m_backColor;
 }
 
+bool Scene::hitPrimary(const Ray& r, HitRec& hrec, uint16_t& entry) const
+{
+	if (entry == PrimaryHitCache::kEscaped) {
+		return false;
+	}
+	// Rays known to escape are not traced, so only the others count.
+	RenderStats::countRay(true);
+	if (entry != PrimaryHitCache::kUnknown) {
+		return m_world->hitChild(entry - PrimaryHitCache::kFirstShape, r, 0.001, FLT_MAX, hrec);
+	}
+	int child;
+	if (!m_world->hit(r, 0.001, FLT_MAX, hrec, child)) {
+		entry = PrimaryHitCache::kEscaped;
+		return false;
+	}
+	if (child <= 0xffff - PrimaryHitCache::kFirstShape) {
+		entry = uint16_t(PrimaryHitCache::kFirstShape + child);
+	}
+	return true;
+}
+
+bool Scene::scatter(const Ray& r, const HitRec& hrec, ScatterRec& srec, Sampler& sampler, float& pdf) const
+{
+	pdf = 0;
+	if (!m_guide || hrec.mat->isSpecular()) {
+		return hrec.mat->scatter(r, hrec, srec, sampler);
+	}
+
+	// One-sample mixture of the guide and the BSDF, weighted by the mixture density.
+	// The BSDF is sampled either way, which also rejects non-scattering materials.
+	if (!hrec.mat->scatter(r, hrec, srec, sampler)) {
+		return false;
+	}
+	vec3 wo = -normalize(r.direction());
+	vec3 wi = normalize(srec.ray.direction());
+	if (m_guide->ready() && sampler.get1D() < PathGuide::GUIDE_FRACTION) {
+		float u1, u2;
+		sampler.get2D(u1, u2);
+		wi = m_guide->sample(hrec.p, u1, u2);
+	}
+	pdf = hrec.mat->pdf(hrec, wo, wi);
+	if (m_guide->ready()) {
+		pdf = mix(pdf, m_guide->pdf(hrec.p, wi), PathGuide::GUIDE_FRACTION);
+	}
+	if (pdf <= 0) {
+		return false;
+	}
+	srec.ray = Ray(hrec.p, wi);
+	srec.albedo = hrec.mat->eval(hrec, wo, wi) * (std::max(dot(wi, hrec.n), 0.f) / pdf);
+	return true;
+}
+
+vec3 Scene::pixel(int i, int j, Sampler& sampler, FirstHit* features) const {
+	vec3 c(0);
+	FirstHit sum = { vec3(0), vec3(0), 0, 0, -1 };
+	for (int s = 0; s < m_samples; ++s) {
+		float du, dv;
+		sampler.start(i, j, m_firstSample + s);
+		sampler.get2D(du, dv);
+		float u = (float(i) + du) / float(m_width);
+		float v = (float(j) + dv) / float(m_height);
+		Ray r = m_camera->getRay(u, v);
+		FirstHit first = { vec3(0), vec3(0), 0, 0, -1 };
+		if (m_integrator == kBDPT) {
+			c += m_bdpt->Li(r, sampler);
+			HitRec hrec;
+			if (features) {
+				RenderStats::countRay(true);
+			}
+			if (features && m_world->hit(r, 0.001, FLT_MAX, hrec)) {
+				first = { hrec.mat->albedo(hrec), hrec.n, hrec.t * length(r.direction()), hrec.t, materialIndex(hrec.mat.get()) };
+			}
+		}
+		else {
+			uint16_t* cached = m_primaryHits ? m_primaryHits->entry(i, j, s) : nullptr;
+			c += color(r, m_world.get(), 0, sampler, kCameraPath, features ? &first : nullptr, cached);
+		}
+		if (features) {
+			sum.albedo += first.albedo;
+			sum.normal += first.normal;
+			sum.depth += first.depth;
+			sum.t += first.t;
+			// An id cannot be averaged, so the first sample's is kept.
+			sum.material = s == 0 ? first.material : sum.material;
+		}
+	}
+	if (features) {
+		*features = { sum.albedo / m_samples, sum.normal / m_samples, sum.depth / m_samples, sum.t / m_samples, sum.material };
+	}
+	return c / m_samples;
+}
+
 void Scene::render(int threadNum, int numThread, Vector3 image[], const Vector3& rgb_param, const float refractive_param)
 {
 	build(rgb_param.getX(), rgb_param.getY(), rgb_param.getZ(), refractive_param);
 
-	int nx = m_image->width();
-	int ny = m_image->height();
+	int nx = m_width;
+	int ny = m_height;
+	SamplerPtr sampler = createSampler(m_samplerType, m_width, m_height, m_samples);
 
-	auto begin = ny / numThread * threadNum;
-	auto end = begin + ny / numThread;
+	// Every row is rendered by exactly one thread, and pixels do not depend on which.
+	auto begin = ny * threadNum / numThread;
+	auto end = ny * (threadNum + 1) / numThread;
+	TraceScope trace("render rows", begin);
 	for (int j = begin; j < end; ++j) {
 		for (int i = 0; i < nx; ++i) {
-			vec3 c(0);
-			for (int s = 0; s < m_samples; ++s) {
-				float u = (float(i) + drand48()) / float(nx);
-				float v = (float(j) + drand48()) / float(ny);
-				Ray r = m_camera->getRay(u, v);
-				c += color(r, m_world.get(), 0);
+			const int index = nx * (ny - j - 1) + i;
+			FirstHit features;
+			image[index] = pixel(i, j, *sampler, m_aux ? &features : nullptr);
+			if (m_aux) {
+				if (m_aux->albedo) m_aux->albedo[index] = features.albedo;
+				if (m_aux->normal) m_aux->normal[index] = features.normal;
+				if (m_aux->depth) m_aux->depth[index] = features.depth;
+				if (m_aux->t) m_aux->t[index] = features.t;
+				if (m_aux->materialId) m_aux->materialId[index] = float(features.material);
+				if (m_aux->sampleCount) m_aux->sampleCount[index] = float(m_samples);
+			}
+		}
+	}
+}
+
+void Scene::renderTile(int x0, int y0, int x1, int y1, Vector3 tile[]) const
+{
+	int tw = x1 - x0;
+	SamplerPtr sampler = createSampler(m_samplerType, m_width, m_height, m_samples);
+	for (int y = y0; y < y1; ++y) {
+		int j = m_height - y - 1;
+		for (int i = x0; i < x1; ++i) {
+			tile[tw * (y - y0) + (i - x0)] = pixel(i, j, *sampler);
+		}
+	}
+}
+
+int Scene::materialIndex(const Material* mat) const
+{
+	for (size_t i = 0; i < m_materials.size(); ++i) {
+		if (m_materials[i].get() == mat) {
+			return int(i);
+		}
+	}
+	return -1;
+}
+
+bool Scene::sampleLight(Sampler& sampler, HitRec& hrec, float& pdf) const
+{
+	const int lightCount = int(m_lights.size());
+	if (lightCount == 0) {
+		return false;
+	}
+	float u1, u2;
+	int l = std::min(int(sampler.get1D() * lightCount), lightCount - 1);
+	sampler.get2D(u1, u2);
+	if (!m_lights[l]->sample(u1, u2, hrec)) {
+		return false;
+	}
+	pdf = 1.f / (m_lights[l]->area() * lightCount);
+	return true;
+}
+
+bool Scene::samplePhoton(Sampler& sampler, Ray& ray, vec3& power) const
+{
+	HitRec lrec;
+	float pdf;
+	if (!sampleLight(sampler, lrec, pdf)) {
+		return false;
+	}
+	float u1, u2;
+	sampler.get2D(u1, u2);
+	ray = Ray(lrec.p, ONB(lrec.n).local(sample_cosine_hemisphere(u1, u2)));
+	power = lrec.mat->emitted(ray, lrec) * (PI / pdf);
+	return true;
+}
+
+void Scene::traceCausticPhotons(size_t count, float radius, PhotonMap& map) const
+{
+	const Shape* world = m_world.get();
+	std::vector<TaggedPhotons> stored;
+
+#pragma omp parallel
+	{
+#pragma omp single
+		stored.resize(omp_get_num_threads());
+
+		TaggedPhotons& photons = stored[omp_get_thread_num()];
+		// Photon indices run far beyond the pixel sample count, so use a full sequence.
+		SamplerPtr sampler = createSampler(m_samplerType == kRandomSampler ? kRandomSampler : kSobolSampler, m_width, m_height, m_samples);
+
+#pragma omp for schedule(dynamic, 1024)
+		for (long long k = 0; k < (long long)count; ++k) {
+			sampler->start(-1, -1, int(k));
+			Ray r;
+			vec3 power;
+			if (!samplePhoton(*sampler, r, power)) {
+				continue;
+			}
+			power /= float(count);
+
+			bool specular = false;
+			for (int depth = 0; depth < MAX_DEPTH; ++depth) {
+				HitRec hrec;
+				RenderStats::countRay(false);
+				if (!world->hit(r, 0.001, FLT_MAX, hrec)) {
+					break;
+				}
+				if (!hrec.mat->isSpecular()) {
+					if (specular) {
+						photons.push_back({ k, { hrec.p, hrec.n, normalize(r.direction()), power } });
+					}
+					break;
+				}
+				ScatterRec srec;
+				if (!hrec.mat->scatter(r, hrec, srec, *sampler)) {
+					break;
+				}
+				power = mulPerElem(power, srec.albedo);
+				r = srec.ray;
+				specular = true;
 			}
-			c /= m_samples;
-			image[nx * (ny - j - 1) + i] = c;
 		}
 	}
+
+	map.build(merge_photons(stored), radius, count);
 }
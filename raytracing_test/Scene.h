@@ -1,27 +1,157 @@
 #pragma once
 #include <array>
+#include <cstdint>
+#include <vector>
+#include <memory>
 #include "inline_math.h"
+#include "Sampler.h"
 
 namespace rayt {
 	class Camera;
-	class Image;
 	class Shape;
+	class ShapeList;
+	class Material;
+	class DiffuseLight;
+	class Dielectric;
 	class Ray;
+	class HitRec;
+	class ScatterRec;
+	class PhotonMap;
+	class BDPT;
+	class PathGuide;
+	class PrimaryHitCache;
+
+	enum IntegratorType {
+		kPathTracing = 0,
+		kBDPT,        // Bidirectional path tracing
+		kSPPM,        // Progressive photon mapping, driven by SPPM rather than render()
+		kLightTracing // Paths from the lights splatted to the camera, driven by LightTracer
+	};
+
+	// Contents of the Cornell box built by Scene::build.
+	enum SceneType {
+		kCornellPrism = 0, // The dispersive prism
+		kCornellSpheres,   // A grid of 100 small spheres, intersection heavy
+		kCornellMesh       // A grid of 64 small prisms, 320 triangles and rects
+	};
+
+	// Arbitrary output variables from the first hit, laid out like the image and
+	// averaged over each pixel's samples. Null buffers are skipped.
+	struct AuxBuffers {
+		Vector3* albedo;
+		Vector3* normal;
+		float* depth;       // Distance from the camera, 0 where nothing was hit
+		float* t;           // HitRec::t along the unnormalized camera ray
+		float* materialId;  // Index into materials(), -1 where nothing was hit
+		float* sampleCount;
+	};
 
 	class Scene {
 	public:
-		Scene(int width, int height, int samples);
+		Scene(int width, int height, int samples, SamplerType samplerType = kSobolSampler);
+		// Shares the geometry, lights and materials of a built scene to render it at
+		// another size and sample count, without building it again. The camera is
+		// reset to the default view.
+		Scene(const Scene& built, int width, int height, int samples, SamplerType samplerType = kSobolSampler);
 		~Scene();
 		void build(float r_param, float g_param, float b_param, float refractive_param);
+		// Changes the light color and prism IOR of a built scene in place, keeping
+		// the geometry. Every scene sharing the materials sees the change, so no
+		// render may be running.
+		void setParameters(float r_param, float g_param, float b_param, float refractive_param);
+		// Moves the camera of a built scene; vfov is vertical, in degrees.
+		void setCamera(const vec3& lookfrom, const vec3& lookat, float vfov);
+		// Selects what the next build() puts into the box.
+		void setSceneType(SceneType type) { m_sceneType = type; }
 		void render(int threadNum, int numThread, Vector3 image[], const Vector3& rgb_param, const float refractive_param);
+		// Renders image rows [y0, y1) and columns [x0, x1) of a built scene into a (x1 - x0) wide tile, top row first.
+		void renderTile(int x0, int y0, int x1, int y1, Vector3 tile[]) const;
+
+		// Emits photons from the lights of a built scene and keeps those that reach a
+		// diffuse surface through at least one specular bounce (L S+ D paths).
+		void traceCausticPhotons(size_t count, float radius, PhotonMap& map) const;
+		// Caustics are then read from the map at diffuse hits instead of being path traced.
+		void setPhotonMap(const PhotonMap* map) { m_photonMap = map; }
+		void setIntegrator(IntegratorType integrator) { m_integrator = integrator; }
+		// Diffuse bounces then mix guided and BSDF sampling, and train the guide while it is training.
+		void setPathGuide(PathGuide* guide) { m_guide = guide; }
+		// render() then also fills these for its rows.
+		void setAuxBuffers(const AuxBuffers* aux) { m_aux = aux; }
+		// Pixel sample indices start here, so separate passes can draw disjoint parts of the sequence.
+		void setFirstSample(int first) { m_firstSample = first; }
+		// Camera rays then replay the first hits recorded in cache, recording those it
+		// lacks. The cache must be of renders with this geometry, camera, size, sample
+		// count and first sample. Path tracing only.
+		void setPrimaryHitCache(PrimaryHitCache* cache) { m_primaryHits = cache; }
+
+		// Uniformly samples a point on one of the lights; pdf is per unit area over all of them.
+		bool sampleLight(Sampler& sampler, HitRec& hrec, float& pdf) const;
+		// Samples a photon leaving one of the lights; power is the flux of a single-photon emission.
+		bool samplePhoton(Sampler& sampler, Ray& ray, vec3& power) const;
+
+		int width() const { return m_width; }
+		int height() const { return m_height; }
+		int samples() const { return m_samples; }
+		SamplerType samplerType() const { return m_samplerType; }
+		SceneType sceneType() const { return m_sceneType; }
+		// Light color and prism IOR of the last build() or setParameters().
+		const vec3& lightParam() const { return m_lightParam; }
+		float refractiveParam() const { return m_refractiveParam; }
+		const Camera& camera() const { return *m_camera; }
+		const Shape* world() const;
+		const vec3& backColor() const { return m_backColor; }
+		const std::vector<std::shared_ptr<Shape>>& lights() const { return m_lights; }
+		// Materials of a built scene, in a fixed order.
+		const std::vector<std::shared_ptr<Material>>& materials() const { return m_materials; }
+		int materialIndex(const Material* mat) const;
+		const vec3& boundsMin() const { return m_boundsMin; }
+		const vec3& boundsMax() const { return m_boundsMax; }
 
 	private:
-		vec3 color(const rayt::Ray& r, const Shape* world, int depth) const;
+		enum PathState {
+			kCameraPath = 0, // Only specular bounces so far
+			kDiffusePath,    // Last bounce was diffuse
+			kCausticPath     // Specular bounces after a diffuse one
+		};
+
+		struct FirstHit {
+			vec3 albedo;
+			vec3 normal;
+			float depth;
+			float t;
+			int material;
+		};
+
+		vec3 color(const rayt::Ray& r, const Shape* world, int depth, Sampler& sampler, PathState state = kCameraPath, FirstHit* first = nullptr, uint16_t* cached = nullptr) const;
+		// First hit of camera ray r through its primary hit cache entry.
+		bool hitPrimary(const Ray& r, HitRec& hrec, uint16_t& entry) const;
+		vec3 pixel(int i, int j, Sampler& sampler, FirstHit* features = nullptr) const;
+		// Material scattering, guided at diffuse hits. pdf is the density of the chosen
+		// direction when the guide is in use, 0 otherwise.
+		bool scatter(const Ray& r, const HitRec& hrec, ScatterRec& srec, Sampler& sampler, float& pdf) const;
 
 		std::unique_ptr<Camera> m_camera;
-		std::unique_ptr<Image> m_image;
-		std::unique_ptr<Shape> m_world;
+		std::shared_ptr<ShapeList> m_world;
+		std::vector<std::shared_ptr<Shape>> m_lights;
+		std::vector<std::shared_ptr<Material>> m_materials;
+		std::shared_ptr<DiffuseLight> m_lightMaterial;
+		std::shared_ptr<Dielectric> m_glass;
+		std::unique_ptr<BDPT> m_bdpt;
+		const PhotonMap* m_photonMap;
+		PathGuide* m_guide;
+		PrimaryHitCache* m_primaryHits;
+		const AuxBuffers* m_aux;
+		IntegratorType m_integrator;
+		SceneType m_sceneType;
 		vec3 m_backColor;
+		vec3 m_lightParam;
+		float m_refractiveParam;
+		vec3 m_boundsMin;
+		vec3 m_boundsMax;
+		int m_width;
+		int m_height;
 		int m_samples;
+		int m_firstSample;
+		SamplerType m_samplerType;
 	};
 }
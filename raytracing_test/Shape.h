@@ -5,6 +5,9 @@ namespace rayt {
 	class Shape {
 	public:
 		virtual bool hit(const Ray& r, float t0, float t1, HitRec& hrec) const = 0;
+		virtual float area() const { return 0; }
+		// Uniformly samples a point on the surface, filling p, n, u, v and mat of hrec.
+		virtual bool sample(float u1, float u2, HitRec& hrec) const { return false; }
 	};
 
 	//----------------------------------------------------------------------------
@@ -18,19 +21,32 @@ namespace rayt {
 		}
 
 		virtual bool hit(const Ray& r, float t0, float t1, HitRec& hrec) const override {
+			int child;
+			return hit(r, t0, t1, hrec, child);
+		}
+
+		// Also tells which child was hit, so the hit can be repeated with hitChild().
+		bool hit(const Ray& r, float t0, float t1, HitRec& hrec, int& child) const {
 			HitRec temp_rec;
 			bool hit_anything = false;
 			float closest_so_far = t1;
-			for (auto& p : m_list) {
-				if (p->hit(r, t0, closest_so_far, temp_rec)) {
+			for (size_t i = 0; i < m_list.size(); ++i) {
+				if (m_list[i]->hit(r, t0, closest_so_far, temp_rec)) {
 					hit_anything = true;
 					closest_so_far = temp_rec.t;
 					hrec = temp_rec;
+					child = int(i);
 				}
 			}
 			return hit_anything;
 		}
 
+		bool hitChild(int child, const Ray& r, float t0, float t1, HitRec& hrec) const {
+			return m_list[child]->hit(r, t0, t1, hrec);
+		}
+
+		int size() const { return int(m_list.size()); }
+
 	private:
 		std::vector<ShapePtr> m_list;
 	};
@@ -46,6 +62,7 @@ namespace rayt {
 			, m_material(mat) { }
 
 		virtual bool hit(const Ray& r, float t0, float t1, HitRec& hrec) const override {
+			RenderStats::countIntersection(RenderStats::kSphere);
 			vec3 oc = r.origin() - m_center;
 			float a = dot(r.direction(), r.direction());
 			float b = 2.0f * dot(oc, r.direction());
@@ -73,6 +90,23 @@ namespace rayt {
 			return false;
 		}
 
+		virtual float area() const override {
+			return 2.f * PI2 * pow2(m_radius);
+		}
+
+		virtual bool sample(float u1, float u2, HitRec& hrec) const override {
+			float z = 1.f - 2.f * u1;
+			float r = sqrtf(std::max(0.f, 1.f - z * z));
+			float phi = PI2 * u2;
+			hrec.n = vec3(r * cosf(phi), r * sinf(phi), z);
+			hrec.p = m_center + m_radius * hrec.n;
+			hrec.t = 0;
+			hrec.u = u1;
+			hrec.v = u2;
+			hrec.mat = m_material;
+			return true;
+		}
+
 	private:
 		vec3 m_center;
 		float m_radius;
@@ -100,6 +134,7 @@ namespace rayt {
 		}
 
 		virtual bool hit(const Ray& r, float t0, float t1, HitRec& hrec) const override {
+			RenderStats::countIntersection(RenderStats::kRect);
 			int xi, yi, zi;
 			vec3 axis;
 			switch (m_axis) {
@@ -127,6 +162,26 @@ namespace rayt {
 			hrec.n = axis;
 			return true;
 		}
+
+		virtual float area() const override {
+			return (m_x1 - m_x0) * (m_y1 - m_y0);
+		}
+
+		virtual bool sample(float u1, float u2, HitRec& hrec) const override {
+			float x = mix(m_x0, m_x1, u1);
+			float y = mix(m_y0, m_y1, u2);
+			switch (m_axis) {
+			case kXY: hrec.p = vec3(x, y, m_k); hrec.n = vec3::zAxis(); break;
+			case kXZ: hrec.p = vec3(x, m_k, y); hrec.n = vec3::yAxis(); break;
+			case kYZ: hrec.p = vec3(m_k, x, y); hrec.n = vec3::xAxis(); break;
+			}
+			hrec.t = 0;
+			hrec.u = u1;
+			hrec.v = u2;
+			hrec.mat = m_material;
+			return true;
+		}
+
 	private:
 		float m_x0, m_x1, m_y0, m_y1, m_k;
 		AxisType m_axis;
@@ -151,6 +206,20 @@ namespace rayt {
 			}
 		}
 
+		virtual float area() const override {
+			return m_shape->area();
+		}
+
+		virtual bool sample(float u1, float u2, HitRec& hrec) const override {
+			if (m_shape->sample(u1, u2, hrec)) {
+				hrec.n = -hrec.n;
+				return true;
+			}
+			else {
+				return false;
+			}
+		}
+
 	private:
 		ShapePtr m_shape;
 	};
@@ -210,6 +279,20 @@ namespace rayt {
 			}
 		}
 
+		virtual float area() const override {
+			return m_shape->area();
+		}
+
+		virtual bool sample(float u1, float u2, HitRec& hrec) const override {
+			if (m_shape->sample(u1, u2, hrec)) {
+				hrec.p += m_offset;
+				return true;
+			}
+			else {
+				return false;
+			}
+		}
+
 	private:
 		ShapePtr m_shape;
 		vec3 m_offset;
@@ -237,6 +320,21 @@ namespace rayt {
 			}
 		}
 
+		virtual float area() const override {
+			return m_shape->area();
+		}
+
+		virtual bool sample(float u1, float u2, HitRec& hrec) const override {
+			if (m_shape->sample(u1, u2, hrec)) {
+				hrec.p = rotate(m_quat, hrec.p);
+				hrec.n = rotate(m_quat, hrec.n);
+				return true;
+			}
+			else {
+				return false;
+			}
+		}
+
 	private:
 		ShapePtr m_shape;
 		Quat m_quat;
@@ -262,6 +360,7 @@ namespace rayt {
 		}
 
 		virtual bool hit(const Ray& r, float t0, float t1, HitRec& hrec) const override {
+			RenderStats::countIntersection(RenderStats::kTriangle);
 			int xi, yi, zi;
 			vec3 axis;
 			switch (m_axis) {
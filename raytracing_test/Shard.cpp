@@ -0,0 +1,155 @@
+#include <iostream>
+#include <memory>
+#include <algorithm>
+#include "Shard.h"
+
+using namespace rayt;
+
+namespace {
+	bool endsWith(const std::string& s, const std::string& suffix)
+	{
+		return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	// Shards drawing overlapping sample indices of the same sampler are correlated,
+	// and their merge converges no faster than the larger of them.
+	void warnOverlaps(const std::vector<std::unique_ptr<ShardReader>>& shards, const std::vector<std::string>& inputs)
+	{
+		for (size_t a = 0; a < shards.size(); ++a) {
+			for (size_t b = a + 1; b < shards.size(); ++b) {
+				const ShardInfo& i = shards[a]->info();
+				const ShardInfo& j = shards[b]->info();
+				if (i.firstSample >= 0 && j.firstSample >= 0 && i.sampler == j.sampler
+					&& i.firstSample < j.firstSample + j.samples && j.firstSample < i.firstSample + i.samples) {
+					std::cerr << "warning: " << inputs[a] << " and " << inputs[b] << " draw overlapping samples" << std::endl;
+				}
+			}
+		}
+	}
+}
+
+bool rayt::write_shard(const std::string& path, const ShardInfo& info, const std::vector<const Vector3*>& layers)
+{
+	ShardWriter writer;
+	if (int(layers.size()) != info.passes || !writer.open(path, info)) {
+		return false;
+	}
+	std::vector<Vector3> sums(size_t(info.width) * info.passes);
+	std::vector<uint32_t> counts(info.width, uint32_t(info.samples));
+	for (int y = 0; y < info.height; ++y) {
+		for (int p = 0; p < info.passes; ++p) {
+			const Vector3* row = layers[p] + size_t(y) * info.width;
+			for (int x = 0; x < info.width; ++x) {
+				sums[size_t(p) * info.width + x] = row[x] * float(info.samples);
+			}
+		}
+		if (!writer.writeRow(sums.data(), counts.data())) {
+			return false;
+		}
+	}
+	return writer.close();
+}
+
+bool rayt::merge_shards(const std::vector<std::string>& inputs, const std::string& output, ExrWriter::PixelType type, int tileSize)
+{
+	std::vector<std::unique_ptr<ShardReader>> shards;
+	for (const std::string& path : inputs) {
+		shards.push_back(std::make_unique<ShardReader>());
+		if (!shards.back()->open(path)) {
+			std::cerr << "failed to read shard " << path << std::endl;
+			return false;
+		}
+		const ShardInfo& first = shards.front()->info();
+		const ShardInfo& info = shards.back()->info();
+		if (info.width != first.width || info.height != first.height || info.passes != first.passes) {
+			std::cerr << path << " is " << info.width << "x" << info.height << " with " << info.passes << " passes, "
+				<< inputs.front() << " is " << first.width << "x" << first.height << " with " << first.passes << " passes" << std::endl;
+			return false;
+		}
+	}
+	if (shards.empty()) {
+		return false;
+	}
+	warnOverlaps(shards, inputs);
+
+	ShardInfo merged = shards.front()->info();
+	merged.samples = 0;
+	merged.shards = 0;
+	for (auto& shard : shards) {
+		merged.samples += shard->info().samples;
+		merged.shards += shard->info().shards;
+	}
+	merged.firstSample = shards.size() == 1 ? merged.firstSample : -1;
+	const int width = merged.width;
+	const int passes = merged.passes;
+	const size_t rowPixels = size_t(width) * passes;
+
+	// Only one band of rows, an EXR tile high, is ever resident.
+	const bool exr = endsWith(output, ".exr");
+	const int bandHeight = exr ? tileSize : 1;
+	std::vector<Vector3> sums(rowPixels * bandHeight);
+	std::vector<uint32_t> counts(size_t(width) * bandHeight);
+
+	ShardWriter shardOut;
+	ExrWriter exrOut;
+	std::vector<std::string> names;
+	for (int p = 0; p < passes; ++p) {
+		names.push_back("ray_" + std::to_string(p));
+	}
+	names.push_back("sum");
+	// Resolved band: every pass, then the sum, each width x bandHeight.
+	std::vector<Vector3> resolved(exr ? size_t(width) * bandHeight * (passes + 1) : 0);
+	bool ok = exr ? exrOut.open(output, width, merged.height, names, type, tileSize) : shardOut.open(output, merged);
+	if (!ok) {
+		std::cerr << "failed to write " << output << std::endl;
+		return false;
+	}
+
+	for (int y0 = 0; y0 < merged.height && ok; y0 += bandHeight) {
+		const int rows = std::min(bandHeight, merged.height - y0);
+		std::fill(sums.begin(), sums.end(), Vector3(0));
+		std::fill(counts.begin(), counts.end(), 0u);
+		for (int r = 0; r < rows && ok; ++r) {
+			for (auto& shard : shards) {
+				ok = ok && shard->accumulateRow(sums.data() + rowPixels * r, counts.data() + size_t(width) * r);
+			}
+		}
+		if (!ok) {
+			std::cerr << "a shard ends before row " << y0 + rows << std::endl;
+			break;
+		}
+		if (!exr) {
+			ok = shardOut.writeRow(sums.data(), counts.data());
+			continue;
+		}
+
+		const size_t layerSize = size_t(width) * bandHeight;
+		Vector3* sumLayer = resolved.data() + layerSize * passes;
+		for (int r = 0; r < rows; ++r) {
+			for (int x = 0; x < width; ++x) {
+				const uint32_t n = counts[size_t(width) * r + x];
+				Vector3 total(0);
+				for (int p = 0; p < passes; ++p) {
+					Vector3 v = n > 0 ? sums[rowPixels * r + size_t(p) * width + x] / float(n) : Vector3(0);
+					resolved[layerSize * p + size_t(width) * r + x] = v;
+					total += v;
+				}
+				sumLayer[size_t(width) * r + x] = total;
+			}
+		}
+		const int ty = y0 / tileSize;
+		std::vector<const Vector3*> tile(passes + 1);
+		for (int tx = 0; tx < exrOut.numTilesX() && ok; ++tx) {
+			for (int l = 0; l <= passes; ++l) {
+				tile[l] = resolved.data() + layerSize * l + tx * tileSize;
+			}
+			ok = exrOut.writeTile(tx, ty, tile, width);
+		}
+	}
+
+	ok = (exr ? exrOut.close() : shardOut.close()) && ok;
+	if (ok) {
+		std::cout << "merged " << shards.size() << " shards, " << merged.samples << " spp from " << merged.shards << " renders -> " << output << std::endl;
+	}
+	return ok;
+}
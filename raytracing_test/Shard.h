@@ -0,0 +1,157 @@
+#pragma once
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "inline_math.h"
+#include "ExrWriter.h"
+
+namespace rayt {
+	// A render shard: float radiance sums of every wavelength pass and the number
+	// of samples behind every pixel, so shards rendered independently can be
+	// combined with the right weights. Rows are stored top row first, each as
+	// passes x width float RGB sums followed by width uint32 sample counts, so
+	// shards can be read and merged a row at a time.
+	struct ShardInfo {
+		int32_t width;
+		int32_t height;
+		int32_t passes;      // Wavelength passes
+		int32_t samples;     // Samples per pixel, summed over merged shards
+		int32_t firstSample; // Seed: sample indices [firstSample, firstSample + samples), -1 once merged
+		int32_t shards;      // Renders merged into this one
+		int32_t sampler;     // SamplerType
+		int32_t integrator;  // IntegratorType
+	};
+
+	const char SHARD_MAGIC[8] = { 'R', 'A', 'Y', 'T', 'S', 'H', 'R', 'D' };
+	const uint32_t SHARD_VERSION = 1;
+
+	//--------------------------------------------------------------------------------
+
+	class ShardWriter {
+	public:
+		ShardWriter() : m_fp(nullptr) { }
+		~ShardWriter() { close(); }
+
+		bool open(const std::string& path, const ShardInfo& info) {
+			close();
+#ifdef _MSC_VER
+			if (fopen_s(&m_fp, path.c_str(), "wb") != 0) m_fp = nullptr;
+#else
+			m_fp = fopen(path.c_str(), "wb");
+#endif
+			if (!m_fp) {
+				return false;
+			}
+			m_info = info;
+			m_row.resize(size_t(info.width) * info.passes * 3);
+			uint32_t version = SHARD_VERSION;
+			fwrite(SHARD_MAGIC, 1, sizeof(SHARD_MAGIC), m_fp);
+			fwrite(&version, sizeof(version), 1, m_fp);
+			return fwrite(&m_info, sizeof(m_info), 1, m_fp) == 1;
+		}
+
+		// sums holds passes x width radiance sums of the next row.
+		bool writeRow(const Vector3 sums[], const uint32_t counts[]) {
+			for (size_t i = 0; i < m_row.size() / 3; ++i) {
+				m_row[i * 3 + 0] = sums[i].getX();
+				m_row[i * 3 + 1] = sums[i].getY();
+				m_row[i * 3 + 2] = sums[i].getZ();
+			}
+			return m_fp && fwrite(m_row.data(), sizeof(float), m_row.size(), m_fp) == m_row.size()
+				&& fwrite(counts, sizeof(uint32_t), m_info.width, m_fp) == size_t(m_info.width);
+		}
+
+		bool close() {
+			if (!m_fp) {
+				return false;
+			}
+			bool ok = fclose(m_fp) == 0;
+			m_fp = nullptr;
+			return ok;
+		}
+
+	private:
+		FILE* m_fp;
+		ShardInfo m_info;
+		std::vector<float> m_row;
+	};
+
+	//--------------------------------------------------------------------------------
+
+	class ShardReader {
+	public:
+		ShardReader() : m_fp(nullptr) { }
+		~ShardReader() { close(); }
+
+		bool open(const std::string& path) {
+			close();
+#ifdef _MSC_VER
+			if (fopen_s(&m_fp, path.c_str(), "rb") != 0) m_fp = nullptr;
+#else
+			m_fp = fopen(path.c_str(), "rb");
+#endif
+			if (!m_fp) {
+				return false;
+			}
+			char magic[sizeof(SHARD_MAGIC)];
+			uint32_t version;
+			if (fread(magic, 1, sizeof(magic), m_fp) != sizeof(magic) || memcmp(magic, SHARD_MAGIC, sizeof(magic)) != 0
+				|| fread(&version, sizeof(version), 1, m_fp) != 1 || version != SHARD_VERSION
+				|| fread(&m_info, sizeof(m_info), 1, m_fp) != 1 || m_info.width <= 0 || m_info.height <= 0 || m_info.passes <= 0) {
+				close();
+				return false;
+			}
+			m_row.resize(size_t(m_info.width) * m_info.passes * 3);
+			return true;
+		}
+
+		const ShardInfo& info() const { return m_info; }
+
+		// Adds the next row's passes x width sums and width counts to sums and counts.
+		bool accumulateRow(Vector3 sums[], uint32_t counts[]) {
+			m_counts.resize(m_info.width);
+			if (!m_fp || fread(m_row.data(), sizeof(float), m_row.size(), m_fp) != m_row.size()
+				|| fread(m_counts.data(), sizeof(uint32_t), m_counts.size(), m_fp) != m_counts.size()) {
+				return false;
+			}
+			for (size_t i = 0; i < m_row.size() / 3; ++i) {
+				sums[i] += Vector3(m_row[i * 3 + 0], m_row[i * 3 + 1], m_row[i * 3 + 2]);
+			}
+			for (int x = 0; x < m_info.width; ++x) {
+				counts[x] += m_counts[x];
+			}
+			return true;
+		}
+
+		void close() {
+			if (m_fp) {
+				fclose(m_fp);
+				m_fp = nullptr;
+			}
+		}
+
+	private:
+		ShardReader(const ShardReader&) = delete;
+		ShardReader& operator=(const ShardReader&) = delete;
+
+		FILE* m_fp;
+		ShardInfo m_info;
+		std::vector<float> m_row;
+		std::vector<uint32_t> m_counts;
+	};
+
+	//--------------------------------------------------------------------------------
+
+	// Writes one render as a shard: layers are the per-pass framebuffers
+	// (width * height, top row first) averaged over info.samples samples per pixel.
+	bool write_shard(const std::string& path, const ShardInfo& info, const std::vector<const Vector3*>& layers);
+
+	// Combines shards of the same image, weighting every pixel by its sample
+	// counts, a row at a time. An output ending in ".exr" gets every pass as
+	// ray_<n> plus their sum, as the renderer writes it; anything else is written
+	// as a shard again, so merges can be chained.
+	bool merge_shards(const std::vector<std::string>& inputs, const std::string& output,
+		ExrWriter::PixelType type = ExrWriter::kFloat, int tileSize = 64);
+}
@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "Trace.h"
+
+using namespace rayt;
+
+namespace {
+	struct Event {
+		const char* name;
+		int arg;
+		int64_t begin;
+		int64_t end;
+	};
+
+	struct ThreadBuffer {
+		int tid;
+		uint64_t count; // Events ever recorded; the ring holds the last RING_SIZE
+		std::vector<Event> ring;
+	};
+
+	std::atomic<bool> g_enabled(false);
+
+	std::mutex& registryMutex()
+	{
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	// Buffers are never freed, so spans of exited threads still reach write().
+	std::vector<std::unique_ptr<ThreadBuffer>>& registry()
+	{
+		static std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+		return buffers;
+	}
+
+	ThreadBuffer* threadBuffer()
+	{
+		static thread_local ThreadBuffer* buffer = nullptr;
+		if (!buffer) {
+			std::lock_guard<std::mutex> lock(registryMutex());
+			auto& buffers = registry();
+			buffers.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer{ int(buffers.size()), 0, std::vector<Event>(Trace::RING_SIZE) }));
+			buffer = buffers.back().get();
+		}
+		return buffer;
+	}
+
+	std::chrono::steady_clock::time_point epoch()
+	{
+		static const auto start = std::chrono::steady_clock::now();
+		return start;
+	}
+}
+
+void Trace::setEnabled(bool enabled)
+{
+	epoch();
+	g_enabled = enabled;
+}
+
+bool Trace::enabled()
+{
+	return g_enabled.load(std::memory_order_relaxed);
+}
+
+int64_t Trace::now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch()).count();
+}
+
+void Trace::record(const char* name, int arg, int64_t begin, int64_t end)
+{
+	ThreadBuffer* buffer = threadBuffer();
+	buffer->ring[buffer->count % RING_SIZE] = { name, arg, begin, end };
+	++buffer->count;
+}
+
+bool Trace::write(const std::string& path)
+{
+	FILE* fp = nullptr;
+#ifdef _MSC_VER
+	if (fopen_s(&fp, path.c_str(), "w") != 0) fp = nullptr;
+#else
+	fp = fopen(path.c_str(), "w");
+#endif
+	if (!fp) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(registryMutex());
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	for (auto& buffer : registry()) {
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+			first ? "" : ",\n", buffer->tid, buffer->tid);
+		first = false;
+		const uint64_t kept = std::min<uint64_t>(buffer->count, RING_SIZE);
+		for (uint64_t i = buffer->count - kept; i < buffer->count; ++i) {
+			const Event& e = buffer->ring[i % RING_SIZE];
+			fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%lld,\"dur\":%lld",
+				e.name, buffer->tid, (long long)e.begin, (long long)(e.end - e.begin));
+			if (e.arg >= 0) {
+				fprintf(fp, ",\"args\":{\"i\":%d}", e.arg);
+			}
+			fprintf(fp, "}");
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	return fclose(fp) == 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace rayt {
+	// Timeline of render phases for chrome://tracing or Perfetto. Every thread
+	// records finished spans into its own ring buffer, keeping the newest
+	// RING_SIZE; write() dumps them as Chrome trace-event JSON once the threads
+	// are idle. Recording is off until setEnabled(true).
+	class Trace {
+	public:
+		static constexpr int RING_SIZE = 1 << 14;
+
+		static void setEnabled(bool enabled);
+		static bool enabled();
+		// Microseconds since the process started tracing.
+		static int64_t now();
+		// name must outlive the trace, e.g. a string literal. arg < 0 is omitted.
+		static void record(const char* name, int arg, int64_t begin, int64_t end);
+		static bool write(const std::string& path);
+	};
+
+	// Records the span of its own lifetime.
+	class TraceScope {
+	public:
+		TraceScope(const char* name, int arg = -1)
+			: m_name(name)
+			, m_arg(arg)
+			, m_begin(Trace::enabled() ? Trace::now() : -1) { }
+		~TraceScope() {
+			if (m_begin >= 0) {
+				Trace::record(m_name, m_arg, m_begin, Trace::now());
+			}
+		}
+
+	private:
+		TraceScope(const TraceScope&) = delete;
+		TraceScope& operator=(const TraceScope&) = delete;
+
+		const char* m_name;
+		int m_arg;
+		int64_t m_begin;
+	};
+}
@@ -3,7 +3,12 @@
 //
 #include <iostream>
 #include <string>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
 #include <chrono>
+#include <thread>
+#include <algorithm>
 #include <omp.h>
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -13,17 +18,122 @@
 
 #include "Scene.h"
 #include "Image.h"
+#include "ExrWriter.h"
+#include "PpmWriter.h"
+#include "PhotonMap.h"
+#include "SPPM.h"
+#include "LightTracer.h"
+#include "PathGuide.h"
+#include "Denoiser.h"
+#include "RenderStats.h"
+#include "Trace.h"
+#include "Distributed.h"
+#include "Shard.h"
+#include "Daemon.h"
+#include "Pfm.h"
+#include "PrimaryHitCache.h"
 
 constexpr int nx = 408;
 constexpr int ny = 408;
 constexpr int ns = 2000;
 constexpr int NUM_THREAD = 24;
+constexpr rayt::SamplerType SAMPLER = rayt::kSobolSampler;
+
+constexpr rayt::IntegratorType INTEGRATOR = rayt::kPathTracing;
+
+constexpr int SPPM_PASSES = 1000;
+constexpr size_t SPPM_PHOTONS_PER_PASS = 200000;
+constexpr float SPPM_INITIAL_RADIUS = 5.0f;
+constexpr int SPPM_CHECKPOINT_INTERVAL = 50;
+
+// Light tracing gets the same path budget as the camera: ns paths per pixel.
+constexpr size_t LIGHT_TRACING_PATHS = size_t(ns) * nx * ny;
+
+// Linear HDR output: every wavelength layer plus the sum in one tiled EXR.
+constexpr bool SAVE_EXR = true;
+constexpr bool EXR_HALF = false;
+constexpr int EXR_TILE_SIZE = 64;
+constexpr bool SAVE_BMP = true;
+
+// Caustic photon map: LS+D paths through the prism are estimated from photons
+// at diffuse hits instead of being found by chance. 0 disables it.
+constexpr size_t CAUSTIC_PHOTONS = 0;
+constexpr float CAUSTIC_RADIUS = 3.0f;
+
+// Path guiding: training iterations of 1, 2, 4, ... spp learn where light arrives
+// from, and the final render mixes guided and BSDF sampling at diffuse hits.
+// Training samples are discarded. 0 disables it.
+constexpr int GUIDE_TRAINING_ITERATIONS = 0;
+
+// Preview denoising: the path traced bitmaps are filtered with first-hit albedo,
+// normal and depth, so low ns renders are usable for composition. EXR, shard and
+// basis outputs keep the unfiltered sample means. Not available in tiled renders.
+constexpr bool DENOISE = false;
+
+// First-hit AOVs (albedo, normal, depth, t, material id, sample count) added to
+// ray.exr for compositing and debugging.
+constexpr bool SAVE_AOVS = false;
+
+// Streaming tiled render: finished tiles go straight to ray.exr and a tonemapped
+// ray_sum.ppm and are then released, so no full framebuffer is ever resident.
+constexpr bool TILED_RENDER = false;
+constexpr int RENDER_TILE_SIZE = 64;
+
+// Primary hit cache: the first wavelength pass records which shape every camera
+// ray hits (2 bytes per sample, the first samples of each pixel up to the budget)
+// and the other passes, and correlated sweep points, intersect only that shape.
+// Path tracing only, and not in tiled renders. 0 disables it; the full 408x408
+// image at 2000 spp takes 666 MB.
+constexpr size_t PRIMARY_HIT_CACHE_MB = 0;
+
+// Chrome trace of scene builds, row bands, tiles, wavelength passes and saves,
+// written to trace.json for chrome://tracing.
+constexpr bool SAVE_TRACE = false;
+
+// Distributed rendering: "raytracing_test coordinator [port]" leases tiles of
+// every wavelength to workers started with "raytracing_test worker [host] [port]",
+// on this machine or others, and saves their results like a local render. Tiles
+// not returned within the timeout are leased again. Path tracing and BDPT only.
+constexpr int DISTRIBUTED_PORT = 7878;
+constexpr int DISTRIBUTED_TILE_SIZE = 32;
+constexpr double DISTRIBUTED_LEASE_TIMEOUT = 300; // Seconds
+
+// Render shards: "raytracing_test shard <first sample> [file]" also writes the
+// passes as sample-weighted sums (ray.shard by default), drawing sample indices
+// from <first sample> on, so shards with disjoint ranges are independent.
+// "raytracing_test merge <out.exr | out.shard> <shard>..." combines any number
+// of them a row band at a time.
+constexpr const char* SHARD_PATH = "ray.shard";
+
+// Render server: "raytracing_test serve [port]" keeps built scenes resident and
+// renders jobs sent to it on loopback, e.g. by
+// "raytracing_test submit \"render output=preview.bmp spp=16\" [port]".
+// See Daemon.h for the job syntax.
+constexpr int DAEMON_PORT = 7879;
+
+// Parameter sweep: "raytracing_test sweep [file]" renders one image per line
+// "r g b ior" of file (by default the wavelength table below) as sweep_<n>.exr
+// and .bmp. The geometry is built once and only the light and prism materials
+// are patched between points. Path tracing and BDPT only.
+// Correlated sweeps replay the same samples at every point, so paths that miss
+// the prism are identical and sweep_diff_<n>.exr (point n minus point n - 1)
+// shows only the effect of the change; otherwise points draw disjoint samples.
+constexpr bool SWEEP_CORRELATED = true;
+
+// Light basis: image radiance is linear in the emission, per color channel, so
+// "raytracing_test basis" renders every pass under a white light as
+// basis_<n>.pfm, and "raytracing_test recolor [file]" scales those by a light
+// color per pass (lines "r g b" of file, by default rgb_params) and saves the
+// result like a render, in milliseconds.
+constexpr const char* BASIS_PREFIX = "basis_";
 
 constexpr int PIXEL_COUNT = nx * ny;
 
 int nxs[NUM_THREAD];
 int nys[NUM_THREAD];
 int nss[NUM_THREAD];
+int first_sample = 0;
+unique_ptr<rayt::PrimaryHitCache> primary_hits;
 
 //const array<Vector3, 1> rgb_params = { Vector3{1.0, 1.0, 1.0} };
 const array<Vector3, 7> rgb_params = {
@@ -46,7 +156,54 @@ const array<float, 7> refractive_params = {
 	2.09
 };
 
-void render(Vector3 pixels[], const Vector3& rgb_param, const float refractive_params)
+void reportStats(double time)
+{
+	if (!rayt::COLLECT_STATS) {
+		return;
+	}
+	vector<rayt::RenderStats> threads;
+	rayt::RenderStats total = rayt::RenderStats::collect(&threads);
+	total.report(std::cout, time);
+	if (!threads.empty()) {
+		auto order = [](const rayt::RenderStats& a, const rayt::RenderStats& b) { return a.rays() < b.rays(); };
+		auto range = std::minmax_element(threads.begin(), threads.end(), order);
+		std::cout << threads.size() << " threads, rays per thread " << range.first->rays() << " - " << range.second->rays() << std::endl;
+	}
+}
+
+void buildPhotonMap(rayt::PhotonMap& photonMap, const Vector3& rgb_param, const float refractive_param)
+{
+	rayt::TraceScope trace("photon map");
+	rayt::Scene scene(nx, ny, ns, SAMPLER);
+	scene.build(rgb_param.getX(), rgb_param.getY(), rgb_param.getZ(), refractive_param);
+	scene.traceCausticPhotons(CAUSTIC_PHOTONS, CAUSTIC_RADIUS, photonMap);
+}
+
+unique_ptr<rayt::PathGuide> trainPathGuide(const Vector3& rgb_param, const float refractive_param)
+{
+	rayt::Scene bounds(nx, ny, ns, SAMPLER);
+	bounds.build(rgb_param.getX(), rgb_param.getY(), rgb_param.getZ(), refractive_param);
+	auto guide = make_unique<rayt::PathGuide>(bounds.boundsMin(), bounds.boundsMax());
+
+	auto scratch = make_unique<Vector3[]>(PIXEL_COUNT);
+	for (int k = 0; k < GUIDE_TRAINING_ITERATIONS; k++) {
+		rayt::TraceScope trace("train guide", k);
+#pragma omp parallel num_threads(NUM_THREAD)
+		{
+			int threadNum = omp_get_thread_num();
+			rayt::Scene scene(nx, ny, 1 << k, SAMPLER);
+			scene.setPathGuide(guide.get());
+			// Keep training paths independent of the ns samples of the final render.
+			scene.setFirstSample(first_sample + ns + (1 << k) - 1);
+			scene.render(threadNum, NUM_THREAD, scratch.get(), rgb_param, refractive_param);
+		}
+		guide->refine();
+	}
+	guide->setTraining(false);
+	return guide;
+}
+
+void render(Vector3 pixels[], const Vector3& rgb_param, const float refractive_params, const rayt::AuxBuffers* aux)
 {
 	for (int i = 0; i < NUM_THREAD; i++) {
 		nxs[i] = nx;
@@ -55,11 +212,32 @@ void render(Vector3 pixels[], const Vector3& rgb_param, const float refractive_p
 	}
 
 	auto begin = std::chrono::high_resolution_clock::now();
+	rayt::RenderStats::clearAll();
+
+	rayt::PhotonMap photonMap;
+	if (CAUSTIC_PHOTONS > 0) {
+		buildPhotonMap(photonMap, rgb_param, refractive_params);
+	}
+
+	unique_ptr<rayt::PathGuide> guide;
+	if (GUIDE_TRAINING_ITERATIONS > 0) {
+		guide = trainPathGuide(rgb_param, refractive_params);
+	}
+
+	if (PRIMARY_HIT_CACHE_MB > 0 && INTEGRATOR == rayt::kPathTracing && !primary_hits) {
+		primary_hits = make_unique<rayt::PrimaryHitCache>(nx, ny, ns, PRIMARY_HIT_CACHE_MB << 20);
+	}
 
 #pragma omp parallel num_threads(NUM_THREAD)
 	{
 		int threadNum = omp_get_thread_num();
-		unique_ptr<rayt::Scene> scene(make_unique<rayt::Scene>(nxs[threadNum], nys[threadNum], nss[threadNum]));
+		unique_ptr<rayt::Scene> scene(make_unique<rayt::Scene>(nxs[threadNum], nys[threadNum], nss[threadNum], SAMPLER));
+		scene->setPhotonMap(CAUSTIC_PHOTONS > 0 ? &photonMap : nullptr);
+		scene->setIntegrator(INTEGRATOR);
+		scene->setPathGuide(guide.get());
+		scene->setAuxBuffers(aux);
+		scene->setFirstSample(first_sample);
+		scene->setPrimaryHitCache(primary_hits.get());
 
 		scene->render(threadNum, NUM_THREAD, pixels, rgb_param, refractive_params);
 
@@ -69,42 +247,579 @@ void render(Vector3 pixels[], const Vector3& rgb_param, const float refractive_p
 
 	const double time = std::chrono::duration_cast<std::chrono::duration<double>>(end - begin).count();
 	std::cout << "time " << time << "[s]" << std::endl;
+	reportStats(time);
+}
+
+void renderSPPM(Vector3 pixels[], const Vector3& rgb_param, const float refractive_param, const string& checkpoint_path)
+{
+	auto begin = std::chrono::high_resolution_clock::now();
+	rayt::RenderStats::clearAll();
+
+	rayt::Scene scene(nx, ny, ns, SAMPLER);
+	scene.build(rgb_param.getX(), rgb_param.getY(), rgb_param.getZ(), refractive_param);
+	rayt::SPPM sppm(scene, SPPM_PASSES, SPPM_PHOTONS_PER_PASS, SPPM_INITIAL_RADIUS);
+	if (sppm.loadCheckpoint(checkpoint_path)) {
+		std::cout << "resuming " << checkpoint_path << " at pass " << sppm.passes() << std::endl;
+	}
+	while (sppm.passes() < SPPM_PASSES) {
+		sppm.run(std::min(sppm.passes() + SPPM_CHECKPOINT_INTERVAL, SPPM_PASSES));
+		sppm.saveCheckpoint(checkpoint_path);
+	}
+	sppm.resolve(pixels);
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	const double time = std::chrono::duration_cast<std::chrono::duration<double>>(end - begin).count();
+	std::cout << "time " << time << "[s]" << std::endl;
+	reportStats(time);
+}
+
+void renderLightTracing(Vector3 pixels[], const Vector3& rgb_param, const float refractive_param)
+{
+	auto begin = std::chrono::high_resolution_clock::now();
+	rayt::RenderStats::clearAll();
+
+	rayt::Scene scene(nx, ny, ns, SAMPLER);
+	scene.build(rgb_param.getX(), rgb_param.getY(), rgb_param.getZ(), refractive_param);
+	rayt::LightTracer tracer(scene);
+	tracer.run(LIGHT_TRACING_PATHS);
+	tracer.resolve(pixels);
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	const double time = std::chrono::duration_cast<std::chrono::duration<double>>(end - begin).count();
+	std::cout << "time " << time << "[s]" << std::endl;
+	reportStats(time);
+}
+
+void renderTiled(const string& exr_path, const string& ppm_path)
+{
+	constexpr int LAYER_COUNT = int(rgb_params.size()) + 1;
+	vector<string> layer_names;
+	for (int i = 0; i < int(rgb_params.size()); i++)
+	{
+		layer_names.push_back("ray_" + to_string(i));
+	}
+	layer_names.push_back("sum");
+
+	rayt::ExrWriter exr;
+	rayt::PpmWriter ppm;
+	auto type = EXR_HALF ? rayt::ExrWriter::kHalf : rayt::ExrWriter::kFloat;
+	if (!exr.open(exr_path, nx, ny, layer_names, type, RENDER_TILE_SIZE) || !ppm.open(ppm_path, nx, ny)) {
+		std::cerr << "failed to open " << exr_path << " / " << ppm_path << std::endl;
+		return;
+	}
+	const int tileCount = exr.numTilesX() * exr.numTilesY();
+	bool written = true;
+
+	auto begin = std::chrono::high_resolution_clock::now();
+	rayt::RenderStats::clearAll();
+
+	vector<rayt::PhotonMap> photonMaps(rgb_params.size());
+	if (CAUSTIC_PHOTONS > 0) {
+		for (int i = 0; i < int(rgb_params.size()); i++)
+		{
+			buildPhotonMap(photonMaps[i], rgb_params[i], refractive_params[i]);
+		}
+	}
+
+	vector<unique_ptr<rayt::PathGuide>> guides(rgb_params.size());
+	if (GUIDE_TRAINING_ITERATIONS > 0) {
+		for (int i = 0; i < int(rgb_params.size()); i++)
+		{
+			guides[i] = trainPathGuide(rgb_params[i], refractive_params[i]);
+		}
+	}
+
+#pragma omp parallel num_threads(NUM_THREAD)
+	{
+		vector<unique_ptr<rayt::Scene>> scenes;
+		for (int i = 0; i < int(rgb_params.size()); i++)
+		{
+			scenes.push_back(make_unique<rayt::Scene>(nx, ny, ns, SAMPLER));
+			scenes.back()->build(rgb_params[i].getX(), rgb_params[i].getY(), rgb_params[i].getZ(), refractive_params[i]);
+			scenes.back()->setPhotonMap(CAUSTIC_PHOTONS > 0 ? &photonMaps[i] : nullptr);
+			scenes.back()->setIntegrator(INTEGRATOR);
+			scenes.back()->setPathGuide(guides[i].get());
+		}
+		rayt::ToneMapper tonemap;
+
+#pragma omp for schedule(dynamic)
+		for (int t = 0; t < tileCount; ++t)
+		{
+			int tx = t % exr.numTilesX();
+			int ty = t / exr.numTilesX();
+			int x0, y0, x1, y1;
+			exr.tileBounds(tx, ty, x0, y0, x1, y1);
+			const int tilePixels = (x1 - x0) * (y1 - y0);
+			rayt::TraceScope trace("tile", t);
+
+			auto tile = make_unique<Vector3[]>(size_t(tilePixels) * LAYER_COUNT);
+			Vector3* sum = tile.get() + size_t(tilePixels) * (LAYER_COUNT - 1);
+			for (int p = 0; p < tilePixels; ++p)
+			{
+				sum[p] = { 0,0,0 };
+			}
+			vector<const Vector3*> layers;
+			for (int i = 0; i < int(scenes.size()); i++)
+			{
+				Vector3* layer = tile.get() + size_t(tilePixels) * i;
+				scenes[i]->renderTile(x0, y0, x1, y1, layer);
+				for (int p = 0; p < tilePixels; ++p)
+				{
+					sum[p] += layer[p];
+				}
+				layers.push_back(layer);
+			}
+			layers.push_back(sum);
+
+			auto rgb8u = make_unique<rayt::Image::rgb[]>(tilePixels);
+			tonemap.apply(sum, rgb8u.get(), tilePixels);
+
+#pragma omp critical(tile_output)
+			{
+				written = exr.writeTile(tx, ty, layers, x1 - x0) && written;
+				written = ppm.writeTile(x0, y0, x1, y1, rgb8u.get(), x1 - x0) && written;
+			}
+		}
+	}
+
+	written = exr.close() && written;
+	written = ppm.close() && written;
+	if (!written) {
+		std::cerr << "failed to write " << exr_path << " / " << ppm_path << ", the images are incomplete" << std::endl;
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	const double time = std::chrono::duration_cast<std::chrono::duration<double>>(end - begin).count();
+	std::cout << "time " << time << "[s]" << std::endl;
+	reportStats(time);
+}
+
+bool renderDistributed(int port, vector<unique_ptr<Vector3[]>>& layers)
+{
+	if (INTEGRATOR != rayt::kPathTracing && INTEGRATOR != rayt::kBDPT) {
+		std::cerr << "distributed rendering supports path tracing and BDPT only" << std::endl;
+		return false;
+	}
+	rayt::DistributedJob job = { nx, ny, ns, DISTRIBUTED_TILE_SIZE, SAMPLER, INTEGRATOR, rayt::kCornellPrism,
+		vector<Vector3>(rgb_params.begin(), rgb_params.end()), vector<float>(refractive_params.begin(), refractive_params.end()),
+		DISTRIBUTED_LEASE_TIMEOUT };
+
+	auto begin = std::chrono::high_resolution_clock::now();
+	bool ok = rayt::runCoordinator(job, port, layers);
+	auto end = std::chrono::high_resolution_clock::now();
+
+	const double time = std::chrono::duration_cast<std::chrono::duration<double>>(end - begin).count();
+	std::cout << "time " << time << "[s]" << std::endl;
+	return ok;
 }
 
-void save(const string& file_path, Vector3 pixels[])
+void save(const string& file_path, const Vector3 pixels[])
 {
-	rayt::Image image(nx, ny);
+	rayt::TraceScope trace("save bmp");
+	static const rayt::ToneMapper tonemap;
 	auto rgb8uPixels = make_unique<rayt::Image::rgb[]>(PIXEL_COUNT);
+	tonemap.apply(pixels, rgb8uPixels.get(), PIXEL_COUNT);
+	stbi_write_bmp(file_path.c_str(), nx, ny, sizeof(rayt::Image::rgb), rgb8uPixels.get());
+}
+
+void saveExr(const string& file_path, const vector<string>& names, const vector<const Vector3*>& layers,
+	const vector<string>& scalar_names = {}, const vector<const float*>& scalar_layers = {})
+{
+	rayt::TraceScope trace("save exr");
+	auto type = EXR_HALF ? rayt::ExrWriter::kHalf : rayt::ExrWriter::kFloat;
+	if (!rayt::write_exr(file_path, nx, ny, names, layers, type, EXR_TILE_SIZE, scalar_names, scalar_layers)) {
+		std::cerr << "failed to write " << file_path << std::endl;
+	}
+}
+
+// previous is the point before, or null for the first.
+void saveSweepPoint(int k, const Vector3 pixels[], const Vector3 previous[])
+{
+	rayt::TraceScope trace("sweep point", k);
+	if (SAVE_BMP) {
+		save("sweep_" + to_string(k) + ".bmp", pixels);
+	}
+	saveExr("sweep_" + to_string(k) + ".exr", { "ray" }, { pixels });
+	if (!previous) {
+		return;
+	}
+
+	vector<Vector3> diff(PIXEL_COUNT);
+	int unchanged = 0;
+	double se = 0;
 	for (int i = 0; i < PIXEL_COUNT; ++i)
 	{
-		rgb8uPixels[i] = image.getWrite(pixels[i]);
+		diff[i] = pixels[i] - previous[i];
+		float d2 = lengthSqr(diff[i]);
+		unchanged += d2 == 0.f ? 1 : 0;
+		se += d2;
 	}
-	stbi_write_bmp(file_path.c_str(), nx, ny, sizeof(rayt::Image::rgb), rgb8uPixels.get());
+	std::cout << "sweep " << k << ": " << 100.0 * unchanged / PIXEL_COUNT << "% of pixels unchanged, RMS difference "
+		<< sqrt(se / (3.0 * PIXEL_COUNT)) << std::endl;
+	saveExr("sweep_diff_" + to_string(k) + ".exr", { "diff" }, { diff.data() });
+}
+
+struct SweepPoint
+{
+	Vector3 rgb;
+	float ior;
+};
+
+bool readSweep(const string& path, vector<SweepPoint>& points)
+{
+	std::ifstream in(path);
+	string line;
+	while (std::getline(in, line)) {
+		std::istringstream fields(line);
+		float r, g, b, ior;
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		if (!(fields >> r >> g >> b >> ior)) {
+			std::cerr << path << ": expected \"r g b ior\", got \"" << line << "\"" << std::endl;
+			return false;
+		}
+		points.push_back({ Vector3(r, g, b), ior });
+	}
+	return in.eof() && !points.empty();
+}
+
+void renderSweep(const vector<SweepPoint>& points)
+{
+	auto begin = std::chrono::high_resolution_clock::now();
+	rayt::RenderStats::clearAll();
+
+	// One built scene is shared by every thread; it is only patched between points.
+	rayt::Scene scene(nx, ny, ns, SAMPLER);
+	scene.setIntegrator(INTEGRATOR);
+	scene.build(points[0].rgb.getX(), points[0].rgb.getY(), points[0].rgb.getZ(), points[0].ior);
+	unique_ptr<rayt::PrimaryHitCache> hits;
+	if (PRIMARY_HIT_CACHE_MB > 0 && INTEGRATOR == rayt::kPathTracing && SWEEP_CORRELATED) {
+		hits = make_unique<rayt::PrimaryHitCache>(nx, ny, ns, PRIMARY_HIT_CACHE_MB << 20);
+		scene.setPrimaryHitCache(hits.get());
+	}
+
+	// A point is saved, and compared with the one before, on a thread of its own
+	// while the next is rendered into the third buffer. The parameters are only
+	// patched between renders, never while the scene is in use.
+	unique_ptr<Vector3[]> buffers[3];
+	for (auto& b : buffers) {
+		b = make_unique<Vector3[]>(PIXEL_COUNT);
+	}
+	std::thread saver;
+	for (int k = 0; k < int(points.size()); ++k) {
+		scene.setParameters(points[k].rgb.getX(), points[k].rgb.getY(), points[k].rgb.getZ(), points[k].ior);
+		scene.setFirstSample(SWEEP_CORRELATED ? 0 : k * ns);
+
+		Vector3* pixels = buffers[k % 3].get();
+#pragma omp parallel for schedule(dynamic) num_threads(NUM_THREAD)
+		for (int y = 0; y < ny; ++y) {
+			scene.renderTile(0, y, nx, y + 1, pixels + size_t(y) * nx);
+		}
+
+		// The next render overwrites the buffers of point k - 2, which the previous save reads.
+		if (saver.joinable()) {
+			saver.join();
+		}
+		const Vector3* previous = k > 0 ? buffers[(k - 1) % 3].get() : nullptr;
+		saver = std::thread(saveSweepPoint, k, pixels, previous);
+	}
+	if (saver.joinable()) {
+		saver.join();
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	const double time = std::chrono::duration_cast<std::chrono::duration<double>>(end - begin).count();
+	std::cout << points.size() << " sweep points, time " << time << "[s]" << std::endl;
+	reportStats(time);
+}
+
+bool readColors(const string& path, vector<Vector3>& colors)
+{
+	std::ifstream in(path);
+	string line;
+	while (std::getline(in, line)) {
+		std::istringstream fields(line);
+		float r, g, b;
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		if (!(fields >> r >> g >> b)) {
+			std::cerr << path << ": expected \"r g b\", got \"" << line << "\"" << std::endl;
+			return false;
+		}
+		colors.push_back(Vector3(r, g, b));
+	}
+	return in.eof() && !colors.empty();
 }
 
-int main()
+bool recolor(const vector<Vector3>& colors)
 {
+	auto begin = std::chrono::high_resolution_clock::now();
+
 	auto sum_pixels = make_unique<Vector3[]>(PIXEL_COUNT);
 	for (int i = 0; i < PIXEL_COUNT; ++i)
 	{
 		sum_pixels[i] = { 0,0,0 };
 	}
+	vector<unique_ptr<Vector3[]>> layers;
+	for (int i = 0; i < int(colors.size()); i++)
+	{
+		int width, height;
+		vector<Vector3> basis;
+		const string path = BASIS_PREFIX + to_string(i) + ".pfm";
+		if (!rayt::read_pfm(path, width, height, basis) || width != nx || height != ny) {
+			std::cerr << "missing or mismatched " << path << std::endl;
+			return false;
+		}
+		layers.push_back(make_unique<Vector3[]>(PIXEL_COUNT));
+		for (int p = 0; p < PIXEL_COUNT; ++p)
+		{
+			layers.back()[p] = mulPerElem(colors[i], basis[p]);
+			sum_pixels[p] += layers.back()[p];
+		}
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	const double time = std::chrono::duration_cast<std::chrono::duration<double>>(end - begin).count();
+	std::cout << "recolored " << colors.size() << " passes, time " << time * 1000.0 << "[ms]" << std::endl;
+
+	vector<string> names;
+	vector<const Vector3*> buffers;
+	for (int i = 0; i < int(layers.size()); i++)
+	{
+		if (SAVE_BMP) {
+			save("ray_" + to_string(i) + ".bmp", layers[i].get());
+		}
+		names.push_back("ray_" + to_string(i));
+		buffers.push_back(layers[i].get());
+	}
+	if (SAVE_BMP) {
+		save("ray_sum.bmp", sum_pixels.get());
+	}
+	if (SAVE_EXR) {
+		names.push_back("sum");
+		buffers.push_back(sum_pixels.get());
+		saveExr("ray.exr", names, buffers);
+	}
+	return true;
+}
+
+void saveTrace()
+{
+	if (SAVE_TRACE && !rayt::Trace::write("trace.json")) {
+		std::cerr << "failed to write trace.json" << std::endl;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	rayt::Trace::setEnabled(SAVE_TRACE);
+
+	const string mode = argc > 1 ? argv[1] : "";
+	if (mode == "worker") {
+		const string host = argc > 2 ? argv[2] : "127.0.0.1";
+		const int port = argc > 3 ? atoi(argv[3]) : DISTRIBUTED_PORT;
+		bool ok = rayt::runWorker(host, port, NUM_THREAD);
+		saveTrace();
+		return ok ? 0 : 1;
+	}
+	if (mode == "serve") {
+		rayt::DaemonOptions options = { argc > 2 ? atoi(argv[2]) : DAEMON_PORT, NUM_THREAD, SAMPLER,
+			vector<Vector3>(rgb_params.begin(), rgb_params.end()), vector<float>(refractive_params.begin(), refractive_params.end()) };
+		bool ok = rayt::runDaemon(options);
+		saveTrace();
+		return ok ? 0 : 1;
+	}
+	if (mode == "submit" && argc > 2) {
+		return rayt::submitToDaemon(argc > 3 ? atoi(argv[3]) : DAEMON_PORT, argv[2]) ? 0 : 1;
+	}
+	if (mode == "sweep") {
+		vector<SweepPoint> points;
+		if (argc > 2 && !readSweep(argv[2], points)) {
+			std::cerr << "failed to read sweep points from " << argv[2] << std::endl;
+			return 1;
+		}
+		for (int i = 0; argc <= 2 && i < int(rgb_params.size()); i++)
+		{
+			points.push_back({ rgb_params[i], refractive_params[i] });
+		}
+		if (INTEGRATOR != rayt::kPathTracing && INTEGRATOR != rayt::kBDPT) {
+			std::cerr << "sweeps support path tracing and BDPT only" << std::endl;
+			return 1;
+		}
+		renderSweep(points);
+		saveTrace();
+		return 0;
+	}
+	if (mode == "recolor") {
+		vector<Vector3> colors(rgb_params.begin(), rgb_params.end());
+		if (argc > 2) {
+			colors.clear();
+			if (!readColors(argv[2], colors)) {
+				std::cerr << "failed to read light colors from " << argv[2] << std::endl;
+				return 1;
+			}
+		}
+		return recolor(colors) ? 0 : 1;
+	}
+	if (mode == "merge") {
+		if (argc < 4) {
+			std::cerr << "usage: raytracing_test merge <out.exr | out.shard> <shard>..." << std::endl;
+			return 1;
+		}
+		auto type = EXR_HALF ? rayt::ExrWriter::kHalf : rayt::ExrWriter::kFloat;
+		return rayt::merge_shards(vector<string>(argv + 3, argv + argc), argv[2], type, EXR_TILE_SIZE) ? 0 : 1;
+	}
+	const bool shard = mode == "shard";
+	if (shard) {
+		if (INTEGRATOR != rayt::kPathTracing && INTEGRATOR != rayt::kBDPT) {
+			std::cerr << "shards support path tracing and BDPT only" << std::endl;
+			return 1;
+		}
+		first_sample = argc > 2 ? atoi(argv[2]) : 0;
+	}
+	const bool basis = mode == "basis";
+	vector<unique_ptr<Vector3[]>> distributed;
+	if (mode == "coordinator" && !renderDistributed(argc > 2 ? atoi(argv[2]) : DISTRIBUTED_PORT, distributed)) {
+		return 1;
+	}
+
+	if (TILED_RENDER && mode != "coordinator" && !shard && !basis) {
+		if (DENOISE) {
+			std::cerr << "tiled renders cannot be denoised, disable DENOISE or TILED_RENDER" << std::endl;
+			return 1;
+		}
+		renderTiled("ray.exr", "ray_sum.ppm");
+		saveTrace();
+		return 0;
+	}
+
+	auto sum_pixels = make_unique<Vector3[]>(PIXEL_COUNT);
+	auto preview_sum = make_unique<Vector3[]>(PIXEL_COUNT);
+	for (int i = 0; i < PIXEL_COUNT; ++i)
+	{
+		sum_pixels[i] = { 0,0,0 };
+		preview_sum[i] = { 0,0,0 };
+	}
+
+	vector<unique_ptr<Vector3[]>> layers;
+	vector<string> layer_names;
+
+	// Every wavelength sees the same first hits, so the AOVs of the last pass are kept.
+	vector<Vector3> aov_albedo, aov_normal;
+	vector<float> aov_depth, aov_t, aov_material, aov_samples;
+	rayt::AuxBuffers aux = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+	if (DENOISE || SAVE_AOVS) {
+		aov_albedo.assign(PIXEL_COUNT, Vector3(0));
+		aov_normal.assign(PIXEL_COUNT, Vector3(0));
+		aov_depth.assign(PIXEL_COUNT, 0.f);
+		aux.albedo = aov_albedo.data();
+		aux.normal = aov_normal.data();
+		aux.depth = aov_depth.data();
+	}
+	if (SAVE_AOVS) {
+		aov_t.assign(PIXEL_COUNT, 0.f);
+		aov_material.assign(PIXEL_COUNT, -1.f);
+		aov_samples.assign(PIXEL_COUNT, 0.f);
+		aux.t = aov_t.data();
+		aux.materialId = aov_material.data();
+		aux.sampleCount = aov_samples.data();
+	}
 
 	for (int i = 0; i < rgb_params.size(); i++)
 	{
+		rayt::TraceScope trace("wavelength", i);
 		auto ray_pixels = make_unique<Vector3[]>(PIXEL_COUNT);
-		render(ray_pixels.get(), rgb_params[i], refractive_params[i]);
+		const Vector3 light = basis ? Vector3(1) : rgb_params[i];
+		bool traced = false;
+		if (!distributed.empty()) {
+			ray_pixels = move(distributed[i]);
+		}
+		else if (INTEGRATOR == rayt::kSPPM) {
+			renderSPPM(ray_pixels.get(), light, refractive_params[i], (basis ? "basis_sppm_" : "sppm_") + to_string(i) + ".ckpt");
+		}
+		else if (INTEGRATOR == rayt::kLightTracing) {
+			renderLightTracing(ray_pixels.get(), light, refractive_params[i]);
+		}
+		else {
+			render(ray_pixels.get(), light, refractive_params[i], DENOISE || SAVE_AOVS ? &aux : nullptr);
+			traced = true;
+		}
 
-		string file_path = "ray_" + to_string(i) + ".bmp";
-		save(file_path, ray_pixels.get());
+		// Only the bitmaps show the denoised preview.
+		unique_ptr<Vector3[]> denoised;
+		const Vector3* preview = ray_pixels.get();
+		if (DENOISE && traced) {
+			rayt::TraceScope trace("denoise");
+			denoised = make_unique<Vector3[]>(PIXEL_COUNT);
+			rayt::Denoiser denoiser(nx, ny);
+			denoiser.apply(ray_pixels.get(), aux.albedo, aux.normal, aux.depth, denoised.get());
+			preview = denoised.get();
+		}
+
+		if (basis && !rayt::write_pfm(BASIS_PREFIX + to_string(i) + ".pfm", nx, ny, ray_pixels.get())) {
+			std::cerr << "failed to write " << BASIS_PREFIX << i << ".pfm" << std::endl;
+		}
+
+		if (SAVE_BMP) {
+			string file_path = "ray_" + to_string(i) + ".bmp";
+			save(file_path, preview);
+		}
 
 		for (int i = 0; i < PIXEL_COUNT; ++i)
 		{
 			sum_pixels[i] += ray_pixels[i];
+			preview_sum[i] += preview[i];
+		}
+
+		if (SAVE_EXR || shard) {
+			layer_names.push_back("ray_" + to_string(i));
+			layers.push_back(move(ray_pixels));
 		}
 	}
 
-	save("ray_sum.bmp", sum_pixels.get());
+	if (SAVE_BMP) {
+		save("ray_sum.bmp", preview_sum.get());
+	}
+
+	if (shard) {
+		vector<const Vector3*> passes;
+		for (auto& l : layers) {
+			passes.push_back(l.get());
+		}
+		rayt::ShardInfo info = { nx, ny, int(passes.size()), ns, first_sample, 1, SAMPLER, INTEGRATOR };
+		const string path = argc > 3 ? argv[3] : SHARD_PATH;
+		if (!rayt::write_shard(path, info, passes)) {
+			std::cerr << "failed to write " << path << std::endl;
+			return 1;
+		}
+	}
+
+	if (SAVE_EXR) {
+		vector<const Vector3*> buffers;
+		for (auto& l : layers) {
+			buffers.push_back(l.get());
+		}
+		layer_names.push_back("sum");
+		buffers.push_back(sum_pixels.get());
+		vector<string> scalar_names;
+		vector<const float*> scalar_buffers;
+		if (SAVE_AOVS && distributed.empty() && INTEGRATOR != rayt::kSPPM && INTEGRATOR != rayt::kLightTracing) {
+			layer_names.push_back("albedo");
+			buffers.push_back(aov_albedo.data());
+			layer_names.push_back("N");
+			buffers.push_back(aov_normal.data());
+			scalar_names = { "Z", "t", "materialId", "sampleCount" };
+			scalar_buffers = { aov_depth.data(), aov_t.data(), aov_material.data(), aov_samples.data() };
+		}
+		saveExr("ray.exr", layer_names, buffers, scalar_names, scalar_buffers);
+	}
 
+	saveTrace();
 	return 0;
 }
\ No newline at end of file